@@ -37,30 +37,22 @@ typedef struct {
     /* Linux framebuffer */
     int fb_fd;
     struct fb_var_screeninfo fb_var;
+    struct fb_var_screeninfo fb_orig; /* mode and panning to restore */
     struct fb_fix_screeninfo fb_fix;
     uint16_t cmap[3][256];
     uint8_t *fb_base;
     size_t fb_len;
-} twin_fbdev_t;
-
-static void _twin_fbdev_put_span(twin_coord_t left,
-                                 twin_coord_t top,
-                                 twin_coord_t right,
-                                 twin_argb32_t *pixels,
-                                 void *closure)
-{
-    twin_screen_t *screen = SCREEN(closure);
-    twin_fbdev_t *tx = PRIV(closure);
 
-    if (tx->fb_base == MAP_FAILED)
-        return;
+    /* Page flipping, pages is 1 when the driver cannot pan */
+    int pages;
+    int back;
+    twin_region_t frame;
+    /* What each of the last pages - 1 frames redrew, newest first */
+    twin_region_t history[CONFIG_FBDEV_PAGES > 1 ? CONFIG_FBDEV_PAGES - 1 : 1];
 
-    twin_coord_t width = right - left;
-    off_t off = top * screen->width + left;
-    uint32_t *dest =
-        (uint32_t *) ((uintptr_t) tx->fb_base + (off * sizeof(*dest)));
-    memcpy(dest, pixels, width * sizeof(*dest));
-}
+    /* Queued redisplay, if any */
+    twin_work_t *redisplay;
+} twin_fbdev_t;
 
 static void twin_fbdev_get_screen_size(twin_fbdev_t *tx,
                                        int *width,
@@ -79,13 +71,135 @@ static void twin_fbdev_damage(twin_screen_t *screen, twin_fbdev_t *tx)
     twin_screen_damage(tx->screen, 0, 0, width, height);
 }
 
+static void twin_fbdev_set_page(twin_fbdev_t *tx, int page)
+{
+    size_t offset = (size_t) page * tx->fb_var.yres * tx->fb_fix.line_length;
+
+    tx->back = page;
+    twin_screen_set_framebuffer(tx->screen,
+                                &(twin_framebuffer_t){
+                                    .base.b = tx->fb_base + offset,
+                                    .width = tx->fb_var.xres,
+                                    .height = tx->fb_var.yres,
+                                    .stride = tx->fb_fix.line_length,
+                                    .format = TWIN_ARGB32,
+                                    .readable = false,
+                                });
+}
+
+#if CONFIG_FBDEV_PAGES > 1
+/*
+ * The back page last showed a frame 'pages' flips ago. Bring it up to date
+ * by copying whatever changed since from the visible page, leaving out
+ * rectangles the coming update redraws anyway.
+ */
+static void twin_fbdev_copy_forward(twin_fbdev_t *tx)
+{
+    const twin_region_t *damage = &tx->screen->damage;
+    size_t page = (size_t) tx->fb_var.yres * tx->fb_fix.line_length;
+    int front = (tx->back + tx->pages - 1) % tx->pages;
+    uint8_t *src = tx->fb_base + front * page;
+    uint8_t *dst = tx->fb_base + tx->back * page;
+
+    for (int h = 0; h < tx->pages - 1; h++) {
+        for (int i = 0; i < tx->history[h].nrects; i++) {
+            const twin_rect_t *r = &tx->history[h].rects[i];
+            bool redrawn = false;
+
+            for (int j = 0; j < damage->nrects && !redrawn; j++)
+                redrawn = damage->rects[j].left <= r->left &&
+                          r->right <= damage->rects[j].right &&
+                          damage->rects[j].top <= r->top &&
+                          r->bottom <= damage->rects[j].bottom;
+            if (redrawn)
+                continue;
+
+            for (twin_coord_t y = r->top; y < r->bottom; y++) {
+                size_t off = y * tx->fb_fix.line_length + r->left * 4;
+                memcpy(dst + off, src + off, (r->right - r->left) * 4);
+            }
+        }
+    }
+}
+
+/* Show the page just drawn, remember what it redrew, and move on */
+static void twin_fbdev_flip(twin_fbdev_t *tx)
+{
+    struct fb_var_screeninfo var = tx->fb_var;
+
+    var.xoffset = 0;
+    var.yoffset = tx->back * tx->fb_var.yres;
+    if (ioctl(tx->fb_fd, FBIOPAN_DISPLAY, &var) < 0) {
+        log_error("Failed to pan framebuffer, flipping disabled");
+        tx->pages = 1;
+        twin_fbdev_set_page(tx, tx->fb_var.yoffset / tx->fb_var.yres);
+        twin_screen_damage(tx->screen, 0, 0, tx->screen->width,
+                           tx->screen->height);
+        return;
+    }
+    tx->fb_var.yoffset = var.yoffset;
+#if defined(CONFIG_FBDEV_VSYNC)
+    /*
+     * The pan takes effect at the next vertical blank; wait for it so the
+     * page it replaces is off the display before drawing into it again
+     */
+    uint32_t crtc = 0;
+    ioctl(tx->fb_fd, FBIO_WAITFORVSYNC, &crtc);
+#endif
+
+    memmove(&tx->history[1], &tx->history[0],
+            (tx->pages - 2) * sizeof(tx->history[0]));
+    tx->history[0] = tx->frame;
+    twin_fbdev_set_page(tx, (tx->back + 1) % tx->pages);
+}
+#endif
+
+static void _twin_fbdev_put_begin(twin_coord_t left,
+                                  twin_coord_t top,
+                                  twin_coord_t right,
+                                  twin_coord_t bottom,
+                                  void *closure)
+{
+    twin_fbdev_t *tx = PRIV(closure);
+
+    twin_region_add(&tx->frame, left, top, right, bottom);
+}
+
+static void _twin_fbdev_put_end(void *closure)
+{
+    twin_fbdev_t *tx = PRIV(closure);
+
+#if CONFIG_FBDEV_PAGES > 1
+    if (tx->pages > 1)
+        twin_fbdev_flip(tx);
+#endif
+    twin_region_clear(&tx->frame);
+}
+
 static bool twin_fbdev_work(void *closure)
 {
     twin_screen_t *screen = SCREEN(closure);
+    twin_fbdev_t *tx = PRIV(closure);
 
-    if (twin_screen_damaged(screen))
+    tx->redisplay = NULL;
+    if (twin_screen_damaged(screen)) {
+#if CONFIG_FBDEV_PAGES > 1
+        if (tx->pages > 1)
+            twin_fbdev_copy_forward(tx);
+#endif
         twin_screen_update(screen);
-    return true;
+    }
+    return false;
+}
+
+/* Queue one redisplay for however much damage piles up before it runs */
+static void twin_fbdev_damaged(void *closure)
+{
+    twin_fbdev_t *tx = PRIV(closure);
+
+    if (!tx->redisplay)
+        tx->redisplay =
+            twin_set_work(twin_fbdev_work, TWIN_WORK_REDISPLAY, closure);
 }
 
 static bool twin_fbdev_apply_config(twin_fbdev_t *tx)
@@ -95,14 +209,22 @@ static bool twin_fbdev_apply_config(twin_fbdev_t *tx)
         log_error("Failed to get framebuffer information");
         return false;
     }
+    tx->fb_orig = tx->fb_var;
 
-    /* Set the virtual screen size to be the same as the physical screen */
+    /*
+     * Ask for a virtual screen tall enough to hold every page, falling back
+     * to one page the size of the physical screen
+     */
     tx->fb_var.xres_virtual = tx->fb_var.xres;
-    tx->fb_var.yres_virtual = tx->fb_var.yres;
+    tx->fb_var.yres_virtual = tx->fb_var.yres * CONFIG_FBDEV_PAGES;
+    tx->fb_var.xoffset = tx->fb_var.yoffset = 0;
     tx->fb_var.bits_per_pixel = 32;
     if (ioctl(tx->fb_fd, FBIOPUT_VSCREENINFO, &tx->fb_var) < 0) {
-        log_error("Failed to set framebuffer mode");
-        return false;
+        tx->fb_var.yres_virtual = tx->fb_var.yres;
+        if (ioctl(tx->fb_fd, FBIOPUT_VSCREENINFO, &tx->fb_var) < 0) {
+            log_error("Failed to set framebuffer mode");
+            return false;
+        }
     }
 
     /* Read changable information of the framebuffer again */
@@ -120,6 +242,17 @@ static bool twin_fbdev_apply_config(twin_fbdev_t *tx)
     /* Read unchangable information of the framebuffer */
     ioctl(tx->fb_fd, FBIOGET_FSCREENINFO, &tx->fb_fix);
 
+    /* Use as many pages as the driver gave us room for */
+    tx->pages = tx->fb_var.yres_virtual / tx->fb_var.yres;
+    if (tx->pages > CONFIG_FBDEV_PAGES)
+        tx->pages = CONFIG_FBDEV_PAGES;
+    while (tx->pages > 1 && (size_t) tx->pages * tx->fb_var.yres *
+                                    tx->fb_fix.line_length >
+                                tx->fb_fix.smem_len)
+        tx->pages--;
+    if (tx->pages > 1)
+        log_info("Flipping between %d framebuffer pages", tx->pages);
+
     /* Align the framebuffer memory address with the page size */
     off_t pgsize = getpagesize();
     off_t start = (off_t) tx->fb_fix.smem_start & (pgsize - 1);
@@ -184,6 +317,18 @@ static bool twin_vt_setup(twin_fbdev_t *tx)
     return true;
 }
 
+/* Put back the mode and panning the console had before us */
+static void twin_fbdev_restore(twin_fbdev_t *tx)
+{
+    struct fb_var_screeninfo var = tx->fb_var;
+
+    if (ioctl(tx->fb_fd, FBIOPUT_VSCREENINFO, &tx->fb_orig) == 0)
+        return;
+    var.xoffset = tx->fb_orig.xoffset;
+    var.yoffset = tx->fb_orig.yoffset;
+    ioctl(tx->fb_fd, FBIOPAN_DISPLAY, &var);
+}
+
 twin_context_t *twin_fbdev_init(int width, int height)
 {
     char *fbdev_path = getenv(FBDEV_NAME);
@@ -222,7 +367,20 @@ twin_context_t *twin_fbdev_init(int width, int height)
 
     /* Create TWIN screen */
     ctx->screen =
-        twin_screen_create(width, height, NULL, _twin_fbdev_put_span, ctx);
+        twin_screen_create(width, height, _twin_fbdev_put_begin, NULL, ctx);
+    if (!ctx->screen)
+        goto bail_mode;
+    tx->screen = ctx->screen;
+    twin_screen_register_damaged(ctx->screen, twin_fbdev_damaged, ctx);
+
+    /*
+     * Compose straight into the page not on display, which is too slow to
+     * read back, and flip to it once the update is done
+     */
+    twin_fbdev_set_page(tx, tx->pages > 1 ? 1 : 0);
+    twin_screen_set_put_rect(ctx->screen, NULL, _twin_fbdev_put_end);
+    if (tx->pages > 1)
+        twin_screen_damage(ctx->screen, 0, 0, width, height);
 
     /* Create Linux input system object */
     tx->input = twin_linux_input_create(ctx->screen);
@@ -231,13 +389,12 @@ twin_context_t *twin_fbdev_init(int width, int height)
         goto bail_screen;
     }
 
-    /* Setup file handler and work functions */
-    twin_set_work(twin_fbdev_work, TWIN_WORK_REDISPLAY, ctx);
-
     return ctx;
 
 bail_screen:
     twin_screen_destroy(ctx->screen);
+bail_mode:
+    twin_fbdev_restore(tx);
 bail_vt_fd:
     close(tx->vt_fd);
 bail_fb_fd:
@@ -262,6 +419,7 @@ static void twin_fbdev_exit(twin_context_t *ctx)
         return;
 
     twin_fbdev_t *tx = PRIV(ctx);
+    twin_fbdev_restore(tx);
     ioctl(tx->vt_fd, KDSETMODE, KD_TEXT);
     munmap(tx->fb_base, tx->fb_len);
     twin_linux_input_destroy(tx->input);
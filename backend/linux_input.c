@@ -10,6 +10,7 @@
 #include <pthread.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/eventfd.h>
 #include <twin.h>
 #include <unistd.h>
 
@@ -19,12 +20,45 @@
 #define EVDEV_CNT_MAX 32
 #define EVDEV_NAME_SIZE_MAX 50
 
+#define EVDEV_READ_MAX 64
+
+/* Must be a power of two so the indices can wrap freely */
+#define EVENT_RING_SIZE 256
+
+/* How often held back events retry a full ring */
+#define EVENT_RETRY_MS 10
+
+/*
+ * Events travel from the evdev thread to the dispatch loop through a
+ * single-producer, single-consumer ring. Each side only ever writes its
+ * own index, publishing it with a release store once the slot is filled
+ * or consumed, so neither side takes a lock.
+ */
+typedef struct {
+    twin_event_t events[EVENT_RING_SIZE];
+    unsigned head; /* next slot the evdev thread fills */
+    unsigned tail; /* next slot the dispatch loop reads */
+} twin_event_ring_t;
+
 typedef struct {
     twin_screen_t *screen;
     pthread_t evdev_thread;
-    int fd;
+    int fd; /* eventfd signalled when the ring has new events */
+    twin_file_t *file;
+    twin_event_ring_t ring;
     int btns;
     int x, y;
+
+    /* State of the report being read, published at SYN_REPORT */
+    int report_btns;
+    bool moved;
+
+    /*
+     * What a full ring could not take yet: the latest position, and the
+     * button state if it differs from the last one queued
+     */
+    bool motion_pending;
+    int queued_btns;
 } twin_linux_input_t;
 
 static int evdev_fd[EVDEV_CNT_MAX];
@@ -42,62 +76,108 @@ static void check_mouse_bounds(twin_linux_input_t *tm)
         tm->y = tm->screen->height;
 }
 
-static void twin_linux_input_events(struct input_event *ev,
-                                    twin_linux_input_t *tm)
+/* Called on the evdev thread only; a full ring refuses the event */
+static bool twin_event_ring_push(twin_event_ring_t *ring,
+                                 const twin_event_t *ev)
+{
+    unsigned head = ring->head;
+
+    if (head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) ==
+        EVENT_RING_SIZE)
+        return false;
+    ring->events[head % EVENT_RING_SIZE] = *ev;
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+/* Called on the dispatch loop only */
+static bool twin_event_ring_pop(twin_event_ring_t *ring, twin_event_t *ev)
 {
-    /* TODO: twin_screen_dispatch() should be protect by mutex_lock, but the
-     * counterpart piece of code with mutex is not yet sure */
+    unsigned tail = ring->tail;
 
+    if (tail == __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE))
+        return false;
+    *ev = ring->events[tail % EVENT_RING_SIZE];
+    __atomic_store_n(&ring->tail, tail + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+static bool twin_linux_input_post(twin_linux_input_t *tm,
+                                  twin_event_kind_t kind)
+{
     twin_event_t tev;
 
+    tev.kind = kind;
+    tev.u.pointer.screen_x = tm->x;
+    tev.u.pointer.screen_y = tm->y;
+    tev.u.pointer.button = tm->btns;
+    return twin_event_ring_push(&tm->ring, &tev);
+}
+
+/*
+ * Queue what is pending, motion first. While the ring is full, motion
+ * folds into one event at the latest position, and a button that goes
+ * down and up again cancels out, so a release is never lost: the last
+ * transition waits here until there is room.
+ */
+static void twin_linux_input_flush(twin_linux_input_t *tm)
+{
+    if (tm->motion_pending &&
+        twin_linux_input_post(tm, TwinEventMotion))
+        tm->motion_pending = false;
+    if (!tm->motion_pending && tm->btns != tm->queued_btns &&
+        twin_linux_input_post(
+            tm, tm->btns ? TwinEventButtonDown : TwinEventButtonUp))
+        tm->queued_btns = tm->btns;
+}
+
+static bool twin_linux_input_pending(const twin_linux_input_t *tm)
+{
+    return tm->motion_pending || tm->btns != tm->queued_btns;
+}
+
+/*
+ * A device reports each axis and button separately and closes the report
+ * with SYN_REPORT. Collect the whole report first, so that moving both
+ * axes costs a single motion event.
+ */
+static void twin_linux_input_events(struct input_event *ev,
+                                    twin_linux_input_t *tm)
+{
     switch (ev->type) {
     case EV_REL:
         if (ev->code == REL_X) {
             tm->x += ev->value;
-            check_mouse_bounds(tm);
-            tev.kind = TwinEventMotion;
-            tev.u.pointer.screen_x = tm->x;
-            tev.u.pointer.screen_y = tm->y;
-            tev.u.pointer.button = tm->btns;
-            twin_screen_dispatch(tm->screen, &tev);
+            tm->moved = true;
         } else if (ev->code == REL_Y) {
             tm->y += ev->value;
-            check_mouse_bounds(tm);
-            tev.kind = TwinEventMotion;
-            tev.u.pointer.screen_x = tm->x;
-            tev.u.pointer.screen_y = tm->y;
-            tev.u.pointer.button = tm->btns;
-            twin_screen_dispatch(tm->screen, &tev);
+            tm->moved = true;
         }
         break;
     case EV_ABS:
         if (ev->code == ABS_X) {
             tm->x = ev->value;
-            check_mouse_bounds(tm);
-            tev.kind = TwinEventMotion;
-            tev.u.pointer.screen_x = tm->x;
-            tev.u.pointer.screen_y = tm->y;
-            tev.u.pointer.button = tm->btns;
-            twin_screen_dispatch(tm->screen, &tev);
+            tm->moved = true;
         } else if (ev->code == ABS_Y) {
             tm->y = ev->value;
-            check_mouse_bounds(tm);
-            tev.kind = TwinEventMotion;
-            tev.u.pointer.screen_x = tm->x;
-            tev.u.pointer.screen_y = tm->y;
-            tev.u.pointer.button = tm->btns;
-            twin_screen_dispatch(tm->screen, &tev);
+            tm->moved = true;
         }
         break;
     case EV_KEY:
-        if (ev->code == BTN_LEFT) {
-            tm->btns = ev->value > 0 ? 1 : 0;
-            tev.kind = tm->btns ? TwinEventButtonDown : TwinEventButtonUp;
-            tev.u.pointer.screen_x = tm->x;
-            tev.u.pointer.screen_y = tm->y;
-            tev.u.pointer.button = tm->btns;
-            twin_screen_dispatch(tm->screen, &tev);
+        if (ev->code == BTN_LEFT)
+            tm->report_btns = ev->value > 0 ? 1 : 0;
+        break;
+    case EV_SYN:
+        if (ev->code != SYN_REPORT)
+            break;
+        if (tm->moved) {
+            check_mouse_bounds(tm);
+            tm->motion_pending = true;
+            tm->moved = false;
         }
+        tm->btns = tm->report_btns;
+        twin_linux_input_flush(tm);
+        break;
     }
 }
 
@@ -124,28 +204,51 @@ static void *twin_linux_evdev_thread(void *arg)
     }
 
     /* Event polling */
-    struct input_event ev;
+    struct input_event ev[EVDEV_READ_MAX];
     while (1) {
-        /* Wait until any event is available */
-        if (poll(pfds, evdev_cnt, -1) <= 0)
+        /*
+         * Wait until any event is available, or with events held back by
+         * a full ring, until the dispatch loop may have made room
+         */
+        int ready = poll(pfds, evdev_cnt,
+                         twin_linux_input_pending(tm) ? EVENT_RETRY_MS : -1);
+
+        if (ready == 0)
+            twin_linux_input_flush(tm);
+        if (ready < 0)
             continue;
 
-        /* Iterate through all file descriptors */
-        for (int i = 0; i < evdev_cnt; i++) {
-            /* Try reading events */
-            ssize_t n = read(pfds[i].fd, &ev, sizeof(ev));
-            if (n == sizeof(ev)) {
-                /* Handle events */
-                twin_linux_input_events(&ev, tm);
-            }
+        /* Read whatever each ready device has queued in one go */
+        for (int i = 0; ready > 0 && i < evdev_cnt; i++) {
+            if (!(pfds[i].revents & POLLIN))
+                continue;
+            ssize_t n = read(pfds[i].fd, ev, sizeof(ev));
+            for (ssize_t j = 0; j < n / (ssize_t) sizeof(ev[0]); j++)
+                twin_linux_input_events(&ev[j], tm);
         }
+
+        /* Hand the new events over to the dispatch loop */
+        uint64_t one = 1;
+        if (write(tm->fd, &one, sizeof(one)) != sizeof(one))
+            log_error("Failed to signal input events");
     }
 
     return NULL;
 }
 
-static bool dummy(int file, twin_file_op_t ops, void *closure)
+static bool twin_linux_input_drain(int fd,
+                                   twin_file_op_t ops maybe_unused,
+                                   void *closure)
 {
+    twin_linux_input_t *tm = closure;
+    twin_event_t tev;
+    uint64_t count;
+
+    /* Reset the eventfd first, so events pushed from now on signal again */
+    if (read(fd, &count, sizeof(count)) < 0)
+        return true;
+    while (twin_event_ring_pop(&tm->ring, &tev))
+        twin_screen_queue_event(tm->screen, &tev);
     return true;
 }
 
@@ -162,26 +265,40 @@ void *twin_linux_input_create(twin_screen_t *screen)
     tm->x = screen->width / 2;
     tm->y = screen->height / 2;
 
-#if 1
-    /* FIXME: Need to fix the unexpected termination of the program.
-     * Hooking a dummy function here is only a hack*/
-
-    /* Set file handler for reading input device file */
-    twin_set_file(dummy, tm->fd, TWIN_READ, tm);
-#endif
+    /* Drain the event ring on the dispatch loop whenever it is signalled */
+    tm->fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (tm->fd < 0) {
+        log_error("Failed to create input eventfd");
+        free(tm);
+        return NULL;
+    }
+    tm->file = twin_set_file(twin_linux_input_drain, tm->fd, TWIN_READ, tm);
+    if (!tm->file) {
+        log_error("Failed to watch input eventfd");
+        goto bail_fd;
+    }
 
     /* Start event handling thread */
     if (pthread_create(&tm->evdev_thread, NULL, twin_linux_evdev_thread, tm)) {
         log_error("Failed to create evdev thread");
-        return NULL;
+        goto bail_file;
     }
 
     return tm;
+
+bail_file:
+    twin_clear_file(tm->file);
+bail_fd:
+    close(tm->fd);
+    free(tm);
+    return NULL;
 }
 
 void twin_linux_input_destroy(void *_tm)
 {
     twin_linux_input_t *tm = _tm;
+    if (tm->file)
+        twin_clear_file(tm->file);
     close(tm->fd);
     free(tm);
 }
@@ -16,44 +16,68 @@ typedef struct {
     int *pixels;
     SDL_Renderer *render;
     SDL_Texture *texture;
-    twin_coord_t width, height;
-    int image_y;
+    twin_rect_t dirty;
+    twin_work_t *redisplay;
 } twin_sdl_t;
 
+/* SDL offers no file to wait on, so its event queue is polled this often */
+#define TWIN_SDL_POLL_INTERVAL 10
+
 #define SCREEN(x) ((twin_context_t *) x)->screen
 #define PRIV(x) ((twin_sdl_t *) ((twin_context_t *) x)->priv)
 
-static void _twin_sdl_put_begin(twin_coord_t left,
-                                twin_coord_t top,
-                                twin_coord_t right,
-                                twin_coord_t bottom,
-                                void *closure)
+static twin_argb32_t *_twin_sdl_put_rect(twin_coord_t left,
+                                         twin_coord_t top,
+                                         twin_coord_t right,
+                                         twin_coord_t bottom,
+                                         twin_coord_t *stride,
+                                         void *closure)
 {
+    twin_screen_t *screen = SCREEN(closure);
     twin_sdl_t *tx = PRIV(closure);
-    tx->width = right - left;
-    tx->height = bottom - top;
-    tx->image_y = top;
+
+    /* collect the bounds of this update for a single texture upload */
+    if (tx->dirty.left == tx->dirty.right) {
+        tx->dirty.left = left;
+        tx->dirty.top = top;
+        tx->dirty.right = right;
+        tx->dirty.bottom = bottom;
+    } else {
+        if (left < tx->dirty.left)
+            tx->dirty.left = left;
+        if (top < tx->dirty.top)
+            tx->dirty.top = top;
+        if (right > tx->dirty.right)
+            tx->dirty.right = right;
+        if (bottom > tx->dirty.bottom)
+            tx->dirty.bottom = bottom;
+    }
+
+    *stride = screen->width * sizeof(*tx->pixels);
+    return (twin_argb32_t *) &tx->pixels[top * screen->width + left];
 }
 
-static void _twin_sdl_put_span(twin_coord_t left,
-                               twin_coord_t top,
-                               twin_coord_t right,
-                               twin_argb32_t *pixels,
-                               void *closure)
+static void _twin_sdl_put_end(void *closure)
 {
     twin_screen_t *screen = SCREEN(closure);
     twin_sdl_t *tx = PRIV(closure);
+    SDL_Rect rect = {
+        .x = tx->dirty.left,
+        .y = tx->dirty.top,
+        .w = tx->dirty.right - tx->dirty.left,
+        .h = tx->dirty.bottom - tx->dirty.top,
+    };
+
+    if (!rect.w || !rect.h)
+        return;
 
-    for (twin_coord_t ix = left, iy = top; ix < right; ix++) {
-        twin_argb32_t pixel = *pixels++;
-        tx->pixels[iy * screen->width + ix] = pixel;
-    }
-    if ((top + 1 - tx->image_y) == tx->height) {
-        SDL_UpdateTexture(tx->texture, NULL, tx->pixels,
-                          screen->width * sizeof(*pixels));
-        SDL_RenderCopy(tx->render, tx->texture, NULL, NULL);
-        SDL_RenderPresent(tx->render);
-    }
+    SDL_UpdateTexture(tx->texture, &rect,
+                      &tx->pixels[rect.y * screen->width + rect.x],
+                      screen->width * sizeof(*tx->pixels));
+    SDL_RenderCopy(tx->render, tx->texture, NULL, NULL);
+    SDL_RenderPresent(tx->render);
+    tx->dirty.left = tx->dirty.right = 0;
+    tx->dirty.top = tx->dirty.bottom = 0;
 }
 
 static void _twin_sdl_destroy(twin_screen_t *screen maybe_unused,
@@ -72,9 +96,8 @@ static void twin_sdl_damage(twin_screen_t *screen, twin_sdl_t *tx)
     twin_screen_damage(screen, 0, 0, width, height);
 }
 
-static bool twin_sdl_read_events(int file maybe_unused,
-                                 twin_file_op_t ops maybe_unused,
-                                 void *closure)
+static twin_time_t twin_sdl_read_events(twin_time_t now maybe_unused,
+                                        void *closure)
 {
     twin_screen_t *screen = SCREEN(closure);
     twin_sdl_t *tx = PRIV(closure);
@@ -90,8 +113,12 @@ static bool twin_sdl_read_events(int file maybe_unused,
             }
             break;
         case SDL_QUIT:
+            twin_screen_register_damaged(screen, NULL, NULL);
+            if (tx->redisplay)
+                twin_clear_work(tx->redisplay);
             _twin_sdl_destroy(screen, tx);
-            return false;
+            twin_dispatch_exit();
+            return -1;
         case SDL_MOUSEBUTTONDOWN:
         case SDL_MOUSEBUTTONUP:
             tev.u.pointer.screen_x = ev.button.x;
@@ -100,34 +127,44 @@ static bool twin_sdl_read_events(int file maybe_unused,
                 ((ev.button.state >> 8) | (1 << (ev.button.button - 1)));
             tev.kind = ((ev.type == SDL_MOUSEBUTTONDOWN) ? TwinEventButtonDown
                                                          : TwinEventButtonUp);
-            twin_screen_dispatch(screen, &tev);
+            twin_screen_queue_event(screen, &tev);
             break;
         case SDL_KEYDOWN:
         case SDL_KEYUP:
             tev.u.key.key = ev.key.keysym.sym;
             tev.kind = ((ev.key.type == SDL_KEYDOWN) ? TwinEventKeyDown
                                                      : TwinEventKeyUp);
-            twin_screen_dispatch(screen, &tev);
+            twin_screen_queue_event(screen, &tev);
             break;
         case SDL_MOUSEMOTION:
             tev.u.pointer.screen_x = ev.motion.x;
             tev.u.pointer.screen_y = ev.motion.y;
             tev.kind = TwinEventMotion;
             tev.u.pointer.button = ev.motion.state;
-            twin_screen_dispatch(screen, &tev);
+            twin_screen_queue_event(screen, &tev);
             break;
         }
     }
-    return true;
+    return TWIN_SDL_POLL_INTERVAL;
 }
 
 static bool twin_sdl_work(void *closure)
 {
     twin_screen_t *screen = SCREEN(closure);
 
+    PRIV(closure)->redisplay = NULL;
     if (twin_screen_damaged(screen))
         twin_screen_update(screen);
-    return true;
+    return false;
+}
+
+static void twin_sdl_damaged(void *closure)
+{
+    twin_sdl_t *tx = PRIV(closure);
+
+    if (!tx->redisplay)
+        tx->redisplay =
+            twin_set_work(twin_sdl_work, TWIN_WORK_REDISPLAY, closure);
 }
 
 twin_context_t *twin_sdl_init(int width, int height)
@@ -171,12 +208,12 @@ twin_context_t *twin_sdl_init(int width, int height)
     tx->texture = SDL_CreateTexture(tx->render, SDL_PIXELFORMAT_ARGB8888,
                                     SDL_TEXTUREACCESS_STREAMING, width, height);
 
-    ctx->screen = twin_screen_create(width, height, _twin_sdl_put_begin,
-                                     _twin_sdl_put_span, ctx);
-
-    twin_set_file(twin_sdl_read_events, 0, TWIN_READ, ctx);
+    ctx->screen = twin_screen_create(width, height, NULL, NULL, ctx);
+    twin_screen_set_put_rect(ctx->screen, _twin_sdl_put_rect,
+                             _twin_sdl_put_end);
+    twin_screen_register_damaged(ctx->screen, twin_sdl_damaged, ctx);
 
-    twin_set_work(twin_sdl_work, TWIN_WORK_REDISPLAY, ctx);
+    twin_set_timeout(twin_sdl_read_events, 0, ctx);
 
     return ctx;
 
@@ -40,6 +40,7 @@ typedef struct {
     uint32_t *framebuffer;
     int width;
     int height;
+    twin_work_t *redisplay;
 } twin_vnc_t;
 
 typedef struct {
@@ -50,34 +51,26 @@ typedef struct {
 #define CURSOR_WIDTH 14
 #define CURSOR_HEIGHT 20
 
-static void _twin_vnc_put_begin(twin_coord_t left,
-                                twin_coord_t top,
-                                twin_coord_t right,
-                                twin_coord_t bottom,
-                                void *closure)
+static twin_argb32_t *_twin_vnc_put_rect(twin_coord_t left,
+                                         twin_coord_t top,
+                                         twin_coord_t right,
+                                         twin_coord_t bottom,
+                                         twin_coord_t *stride,
+                                         void *closure)
 {
-    (void) left;
-    (void) top;
-    (void) right;
-    (void) bottom;
     twin_vnc_t *tx = PRIV(closure);
-    pixman_region_init_rect(&tx->damage_region, 0, 0, tx->width, tx->height);
+
+    pixman_region_union_rect(&tx->damage_region, &tx->damage_region, left,
+                             top, right - left, bottom - top);
+    *stride = tx->width * sizeof(*tx->framebuffer);
+    return tx->framebuffer + top * tx->width + left;
 }
 
-static void _twin_vnc_put_span(twin_coord_t left,
-                               twin_coord_t top,
-                               twin_coord_t right,
-                               twin_argb32_t *pixels,
-                               void *closure)
+static void _twin_vnc_put_end(void *closure)
 {
     twin_vnc_t *tx = PRIV(closure);
-    uint32_t *fb_pixels = tx->framebuffer + top * tx->width + left;
-    size_t span_width = right - left;
-
-    memcpy(fb_pixels, pixels, span_width * sizeof(*fb_pixels));
-
-    pixman_region_init_rect(&tx->damage_region, left, top, span_width, 1);
 
+    /* submit the whole update at once */
     if (pixman_region_not_empty(&tx->damage_region)) {
         nvnc_display_feed_buffer(tx->display, tx->current_fb,
                                  &tx->damage_region);
@@ -97,9 +90,19 @@ static bool _twin_vnc_work(void *closure)
 {
     twin_screen_t *screen = SCREEN(closure);
 
+    PRIV(closure)->redisplay = NULL;
     if (twin_screen_damaged(screen))
         twin_screen_update(screen);
-    return true;
+    return false;
+}
+
+static void _twin_vnc_damaged(void *closure)
+{
+    twin_vnc_t *tx = PRIV(closure);
+
+    if (!tx->redisplay)
+        tx->redisplay =
+            twin_set_work(_twin_vnc_work, TWIN_WORK_REDISPLAY, closure);
 }
 
 static void _twin_vnc_new_client(struct nvnc_client *client)
@@ -110,9 +113,12 @@ static void _twin_vnc_new_client(struct nvnc_client *client)
 
 static bool _twin_vnc_read_events(int fd, twin_file_op_t op, void *closure)
 {
+    twin_vnc_t *tx = closure;
+
     (void) fd;
     (void) op;
-    (void) closure;
+    aml_poll(tx->aml, 0);
+    aml_dispatch(tx->aml);
     return true;
 }
 
@@ -122,32 +128,28 @@ static void _twin_vnc_pointer_event(struct nvnc_client *client,
                                     enum nvnc_button_mask button)
 {
     twin_peer_t *peer = nvnc_get_userdata(client);
+    struct nvnc *server = nvnc_client_get_server(client);
+    twin_vnc_t *tx = nvnc_get_userdata(server);
+    bool down = button & NVNC_BUTTON_LEFT;
+    bool was_down = peer->prev_button & NVNC_BUTTON_LEFT;
     twin_event_t tev;
-    if ((button & NVNC_BUTTON_LEFT) &&
-        !(peer->prev_button & NVNC_BUTTON_LEFT)) {
-        tev.u.pointer.screen_x = x;
-        tev.u.pointer.screen_y = y;
-        tev.kind = TwinEventButtonDown;
-        tev.u.pointer.button = 1;
-    } else if (!(button & NVNC_BUTTON_LEFT) &&
-               (peer->prev_button & NVNC_BUTTON_LEFT)) {
-        tev.u.pointer.screen_x = x;
-        tev.u.pointer.screen_y = y;
-        tev.kind = TwinEventButtonUp;
-        tev.u.pointer.button = 1;
-    }
-    if ((peer->px != x || peer->py != y)) {
+
+    /* one message may carry both a move and a click; move first */
+    tev.u.pointer.screen_x = x;
+    tev.u.pointer.screen_y = y;
+    if (peer->px != x || peer->py != y) {
         peer->px = x;
         peer->py = y;
-        tev.u.pointer.screen_x = x;
-        tev.u.pointer.screen_y = y;
-        tev.u.pointer.button = 0;
         tev.kind = TwinEventMotion;
+        tev.u.pointer.button = was_down;
+        twin_screen_queue_event(tx->screen, &tev);
+    }
+    if (down != was_down) {
+        tev.kind = down ? TwinEventButtonDown : TwinEventButtonUp;
+        tev.u.pointer.button = 1;
+        twin_screen_queue_event(tx->screen, &tev);
     }
     peer->prev_button = button;
-    struct nvnc *server = nvnc_client_get_server(client);
-    twin_vnc_t *tx = nvnc_get_userdata(server);
-    twin_screen_dispatch(tx->screen, &tev);
 }
 
 static struct nvnc_fb *_twin_vnc_create_cursor()
@@ -223,10 +225,12 @@ twin_context_t *twin_vnc_init(int width, int height)
                     true);
     nvnc_fb_unref(cursor);
 
-    ctx->screen = twin_screen_create(width, height, _twin_vnc_put_begin,
-                                     _twin_vnc_put_span, ctx);
+    ctx->screen = twin_screen_create(width, height, NULL, NULL, ctx);
     if (!ctx->screen)
         goto bail_display;
+    twin_screen_set_put_rect(ctx->screen, _twin_vnc_put_rect,
+                             _twin_vnc_put_end);
+    pixman_region_init(&tx->damage_region);
 
     tx->framebuffer = calloc(width * height, sizeof(uint32_t));
     if (!tx->framebuffer) {
@@ -243,7 +247,7 @@ twin_context_t *twin_vnc_init(int width, int height)
     int aml_fd = aml_get_fd(tx->aml);
     twin_set_file(_twin_vnc_read_events, aml_fd, TWIN_READ, tx);
 
-    twin_set_work(_twin_vnc_work, TWIN_WORK_REDISPLAY, ctx);
+    twin_screen_register_damaged(ctx->screen, _twin_vnc_damaged, ctx);
     tx->screen = ctx->screen;
 
     return ctx;
@@ -279,6 +283,7 @@ static void twin_vnc_exit(twin_context_t *ctx)
 
     twin_vnc_t *tx = PRIV(ctx);
 
+    pixman_region_fini(&tx->damage_region);
     nvnc_display_unref(tx->display);
     nvnc_close(tx->server);
     aml_unref(tx->aml);
@@ -8,6 +8,7 @@
 #define _TWIN_H_
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
 typedef uint8_t twin_a8_t;
@@ -27,6 +28,11 @@ typedef int32_t twin_fixed_t; /* 16.16 format */
 
 typedef enum { TWIN_A8, TWIN_RGB16, TWIN_ARGB32 } twin_format_t;
 
+/*
+ * How a pixmap is sampled when drawn through a non-identity transform
+ */
+typedef enum { TWIN_FILTER_BILINEAR, TWIN_FILTER_NEAREST } twin_filter_t;
+
 #define twin_bytes_per_pixel(format) (1 << (twin_coord_t) (format))
 
 /*
@@ -54,6 +60,28 @@ typedef struct _twin_rect {
     twin_coord_t left, right, top, bottom;
 } twin_rect_t;
 
+/*
+ * A region - a short list of non-overlapping rectangles. Once the list
+ * is full, new rectangles are merged into existing ones, so the region
+ * may grow to cover more than what was added, never less.
+ */
+#define TWIN_REGION_RECTS 8
+
+typedef struct _twin_region {
+    twin_count_t nrects;
+    twin_rect_t rects[TWIN_REGION_RECTS];
+} twin_region_t;
+
+/*
+ * An arena - memory handed out by bumping a pointer and taken back all at
+ * once by a reset. A zeroed arena is empty.
+ */
+typedef struct _twin_arena_chunk twin_arena_chunk_t;
+
+typedef struct _twin_arena {
+    twin_arena_chunk_t *chunks;
+} twin_arena_t;
+
 /*
  * Place matrices in structures so they can be easily copied
  */
@@ -73,6 +101,7 @@ typedef struct _twin_window twin_window_t;
 typedef struct _twin_screen twin_screen_t;
 typedef struct _twin_pixmap twin_pixmap_t;
 typedef struct _twin_animation twin_animation_t;
+typedef struct _twin_text_layout twin_text_layout_t;
 
 /*
  * Events
@@ -180,6 +209,7 @@ typedef struct _twin_pixmap {
     twin_coord_t height; /* pixels */
     twin_coord_t stride; /* bytes */
     twin_matrix_t transform;
+    twin_filter_t filter;
 
     /*
      * Clipping - a single rectangle in pixmap coordinates.
@@ -190,6 +220,12 @@ typedef struct _twin_pixmap {
     twin_coord_t origin_x;
     twin_coord_t origin_y;
 
+    /*
+     * Opaque area hint - a rectangle in pixmap coordinates holding only
+     * opaque pixels. Screen updates skip whatever lies beneath it.
+     */
+    twin_rect_t opaque;
+
     /*
      * Pixels
      */
@@ -218,9 +254,42 @@ typedef void (*twin_put_span_t)(twin_coord_t left,
                                 twin_argb32_t *pixels,
                                 void *closure);
 
+/*
+ * twin_put_rect_t: called for each rectangle to be redrawn, returns where
+ * its top left pixel goes in backend memory and sets the stride between
+ * rows in bytes. The screen then composites straight into that memory.
+ * Returning NULL falls back to put_begin and put_span.
+ * twin_put_end_t: called once all rectangles of an update are drawn
+ */
+typedef twin_argb32_t *(*twin_put_rect_t)(twin_coord_t left,
+                                          twin_coord_t top,
+                                          twin_coord_t right,
+                                          twin_coord_t bottom,
+                                          twin_coord_t *stride,
+                                          void *closure);
+typedef void (*twin_put_end_t)(void *closure);
+
+/*
+ * Backend pixel memory the screen composites into directly. Memory that
+ * is slow to read, such as an uncached or write-combined framebuffer,
+ * is marked not readable and only ever written to, one row at a time.
+ * put_begin, when set, still announces each rectangle before it is drawn.
+ * Switching memory does not damage the screen; backends flipping between
+ * pages keep their contents in step themselves.
+ */
+typedef struct _twin_framebuffer {
+    twin_pointer_t base;
+    twin_coord_t width, height; /* pixels */
+    twin_coord_t stride;        /* bytes */
+    twin_format_t format;       /* TWIN_ARGB32 or TWIN_RGB16 */
+    bool readable;
+} twin_framebuffer_t;
+
 /*
  * A screen
  */
+#define TWIN_SCREEN_EVENTS 32
+
 struct _twin_screen {
     /*
      * List of displayed pixmaps
@@ -260,7 +329,7 @@ struct _twin_screen {
     /*
      * Damage
      */
-    twin_rect_t damage;
+    twin_region_t damage;
     void (*damaged)(void *);
     void *damaged_closure;
     twin_count_t disable;
@@ -270,6 +339,9 @@ struct _twin_screen {
      */
     twin_put_begin_t put_begin;
     twin_put_span_t put_span;
+    twin_put_rect_t put_rect;
+    twin_put_end_t put_end;
+    twin_framebuffer_t framebuffer;
     void *closure;
 
     /*
@@ -281,6 +353,18 @@ struct _twin_screen {
      * Event filter
      */
     bool (*event_filter)(twin_screen_t *screen, twin_event_t *event);
+
+    /*
+     * Input waiting to be dispatched
+     */
+    twin_event_t events[TWIN_SCREEN_EVENTS];
+    twin_count_t nevents;
+    struct _twin_work *events_work;
+
+    /*
+     * Scratch memory for drawing, reset as each update starts
+     */
+    twin_arena_t arena;
 };
 
 /*
@@ -335,11 +419,25 @@ typedef enum _twin_cap {
     TwinCapProjecting,
 } twin_cap_t;
 
+/*
+ * How path fills are antialiased: not at all, by sampling a grid of 2x2,
+ * 4x4 or 8x8 points in each pixel, or by the exact area covered
+ */
+typedef enum _twin_antialias {
+    TwinAntialiasNone,
+    TwinAntialias2x2,
+    TwinAntialias4x4,
+    TwinAntialias8x8,
+    TwinAntialiasArea,
+} twin_antialias_t;
+
 typedef struct _twin_state {
     twin_matrix_t matrix;
     twin_fixed_t font_size;
     twin_style_t font_style;
     twin_cap_t cap_style;
+    struct _twin_font *font; /* NULL for g_twin_font */
+    twin_antialias_t antialias;
 } twin_state_t;
 
 /*
@@ -379,25 +477,46 @@ typedef struct _twin_charmap {
 
 #define TWIN_FONT_TYPE_STROKE 1
 #define TWIN_FONT_TYPE_TTF 2
+#define TWIN_FONT_TYPE_BITMAP 3 /* TTF outlines plus pre-rasterized strikes */
+
+/*
+ * One pre-rasterized glyph: A8 coverage, rows padded to 4 bytes, placed
+ * relative to the pen on the baseline (top is negative above it)
+ */
+typedef struct _twin_font_bitmap {
+    twin_ucs4_t ucs4;
+    int16_t left, top;
+    uint16_t width, height;
+    twin_fixed_t advance;
+    uint32_t offset; /* into the strike's bits */
+} twin_font_bitmap_t;
+
+/* Glyphs rendered for one pixel size, sorted by code point */
+typedef struct _twin_font_strike {
+    int size;
+    int n_bitmaps;
+    const twin_font_bitmap_t *bitmaps;
+    const uint8_t *bits;
+} twin_font_strike_t;
 
 typedef struct _twin_font {
     /* those fields have to be initialized */
     int type;
     const char *name;
     const char *style;
-    const twin_charmap_t *charmap;
+    const twin_charmap_t *charmap; /* sorted by page */
     int n_charmap;
     const signed char *outlines;
     signed char ascender;
     signed char descender;
     signed char height;
-
-    /* those are used at runtime for caching */
-    const twin_charmap_t *cur_page;
-
+    const twin_font_strike_t *strikes; /* TWIN_FONT_TYPE_BITMAP only */
+    int n_strikes;
+    /* outline bytes, set for fonts whose glyphs are checked as drawn */
+    unsigned int n_outlines;
 } twin_font_t;
 
-/* FIXME: one global font for now */
+/* Font for paths without one set by twin_path_set_font() */
 extern twin_font_t *g_twin_font;
 
 /* Built-in default stroke font */
@@ -430,12 +549,13 @@ struct _twin_window {
     twin_argb32_t shadow_color;
     twin_window_style_t style;
     twin_rect_t client;
-    twin_rect_t damage;
+    twin_region_t damage;
     bool client_grab;
     bool want_focus;
     bool draw_queued;
     void *client_data;
     char *name;
+    twin_text_layout_t *name_layout;
 
     twin_draw_func_t draw;
     twin_event_func_t event;
@@ -552,6 +672,7 @@ typedef struct _twin_label {
     twin_style_t font_style;
     twin_point_t offset;
     twin_align_t align;
+    twin_text_layout_t *layout;
 } twin_label_t;
 
 typedef enum _twin_button_signal {
@@ -591,12 +712,42 @@ struct _twin_scroll {
     twin_widget_t widget;
 };
 
+/*
+ * arena.c
+ */
+
+void *twin_arena_alloc(twin_arena_t *arena, size_t size);
+
+void twin_arena_reset(twin_arena_t *arena);
+
+void twin_arena_fini(twin_arena_t *arena);
+
 /*
  * box.c
  */
 
 twin_box_t *twin_box_create(twin_box_t *parent, twin_box_dir_t dir);
 
+/*
+ * blur.c
+ */
+
+bool twin_box_blur(twin_pixmap_t *px,
+                   twin_coord_t left,
+                   twin_coord_t top,
+                   twin_coord_t right,
+                   twin_coord_t bottom,
+                   twin_coord_t radius);
+
+bool twin_blur(twin_pixmap_t *px,
+               twin_coord_t left,
+               twin_coord_t top,
+               twin_coord_t right,
+               twin_coord_t bottom,
+               twin_fixed_t sigma);
+
+void twin_stack_blur(twin_pixmap_t *px);
+
 /*
  * button.c
  */
@@ -627,6 +778,8 @@ twin_pixmap_t *twin_make_cursor(int *hx, int *hy);
 
 void twin_dispatch(void);
 
+void twin_dispatch_exit(void);
+
 /*
  * draw.c
  */
@@ -654,8 +807,6 @@ void twin_fill(twin_pixmap_t *dst,
 
 void twin_premultiply_alpha(twin_pixmap_t *px);
 
-void twin_stack_blur(twin_pixmap_t *px);
-
 /*
  * event.c
  */
@@ -673,6 +824,8 @@ twin_file_t *twin_set_file(twin_file_proc_t file_proc,
 
 void twin_clear_file(twin_file_t *file);
 
+void twin_wakeup(void);
+
 /*
  * fixed.c
  */
@@ -706,6 +859,41 @@ void twin_text_metrics_utf8(twin_path_t *path,
                             const char *string,
                             twin_text_metrics_t *m);
 
+/*
+ * font-file.c
+ */
+
+twin_font_t *twin_font_open(const char *path);
+
+void twin_font_close(twin_font_t *font);
+
+/*
+ * glyph.c
+ */
+
+void twin_paint_utf8(twin_pixmap_t *dst,
+                     twin_argb32_t argb,
+                     twin_path_t *path,
+                     const char *string);
+
+twin_text_layout_t *twin_text_layout_create(twin_path_t *path,
+                                            const char *string);
+
+/* Returns layout if it still fits path and string, else a new one */
+twin_text_layout_t *twin_text_layout_update(twin_text_layout_t *layout,
+                                            twin_path_t *path,
+                                            const char *string);
+
+void twin_text_layout_destroy(twin_text_layout_t *layout);
+
+void twin_text_layout_metrics(const twin_text_layout_t *layout,
+                              twin_text_metrics_t *m);
+
+void twin_paint_text_layout(twin_pixmap_t *dst,
+                            twin_argb32_t argb,
+                            twin_path_t *path,
+                            const twin_text_layout_t *layout);
+
 /*
  * hull.c
  */
@@ -855,6 +1043,8 @@ void twin_path_append(twin_path_t *dst, twin_path_t *src);
 
 twin_path_t *twin_path_create(void);
 
+twin_path_t *twin_path_create_arena(twin_arena_t *arena);
+
 void twin_path_destroy(twin_path_t *path);
 
 void twin_path_identity(twin_path_t *path);
@@ -877,10 +1067,18 @@ twin_style_t twin_path_current_font_style(twin_path_t *path);
 
 void twin_path_set_font_style(twin_path_t *path, twin_style_t font_style);
 
+twin_font_t *twin_path_current_font(twin_path_t *path);
+
+void twin_path_set_font(twin_path_t *path, twin_font_t *font);
+
 void twin_path_set_cap_style(twin_path_t *path, twin_cap_t cap_style);
 
 twin_cap_t twin_path_current_cap_style(twin_path_t *path);
 
+void twin_path_set_antialias(twin_path_t *path, twin_antialias_t antialias);
+
+twin_antialias_t twin_path_current_antialias(twin_path_t *path);
+
 twin_state_t twin_path_save(twin_path_t *path);
 
 void twin_path_restore(twin_path_t *path, twin_state_t *state);
@@ -984,6 +1182,12 @@ void twin_pixmap_unlock(twin_pixmap_t *pixmap);
 
 void twin_pixmap_move(twin_pixmap_t *pixmap, twin_coord_t x, twin_coord_t y);
 
+void twin_pixmap_set_opaque(twin_pixmap_t *pixmap,
+                            twin_coord_t left,
+                            twin_coord_t top,
+                            twin_coord_t right,
+                            twin_coord_t bottom);
+
 twin_pointer_t twin_pixmap_pointer(twin_pixmap_t *pixmap,
                                    twin_coord_t x,
                                    twin_coord_t y);
@@ -1003,6 +1207,22 @@ void twin_fill_path(twin_pixmap_t *pixmap,
                     twin_coord_t dx,
                     twin_coord_t dy);
 
+/*
+ * region.c
+ */
+
+void twin_region_clear(twin_region_t *region);
+
+bool twin_region_empty(const twin_region_t *region);
+
+void twin_region_add(twin_region_t *region,
+                     twin_coord_t left,
+                     twin_coord_t top,
+                     twin_coord_t right,
+                     twin_coord_t bottom);
+
+twin_rect_t twin_region_extents(const twin_region_t *region);
+
 /*
  * screen.c
  */
@@ -1015,6 +1235,13 @@ twin_screen_t *twin_screen_create(twin_coord_t width,
 
 void twin_screen_destroy(twin_screen_t *screen);
 
+void twin_screen_set_put_rect(twin_screen_t *screen,
+                              twin_put_rect_t put_rect,
+                              twin_put_end_t put_end);
+
+void twin_screen_set_framebuffer(twin_screen_t *screen,
+                                 const twin_framebuffer_t *framebuffer);
+
 void twin_screen_enable_update(twin_screen_t *screen);
 
 void twin_screen_disable_update(twin_screen_t *screen);
@@ -1052,6 +1279,8 @@ void twin_screen_set_cursor(twin_screen_t *screen,
 
 bool twin_screen_dispatch(twin_screen_t *screen, twin_event_t *event);
 
+void twin_screen_queue_event(twin_screen_t *screen, const twin_event_t *event);
+
 void twin_screen_lock(twin_screen_t *screen);
 
 void twin_screen_unlock(twin_screen_t *screen);
@@ -1170,6 +1399,7 @@ bool twin_window_dispatch(twin_window_t *window, twin_event_t *event);
 #define TWIN_WORK_REDISPLAY 0
 #define TWIN_WORK_PAINT 1
 #define TWIN_WORK_LAYOUT 2
+#define TWIN_WORK_EVENT 3
 
 twin_work_t *twin_set_work(twin_work_proc_t work_proc,
                            int priority,
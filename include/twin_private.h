@@ -198,6 +198,19 @@ typedef void twin_in_op_func(twin_pointer_t dst,
 
 typedef void twin_op_func(twin_pointer_t dst, twin_source_u src, int width);
 
+/*
+ * Add the coverage in a row of area cells to dst, clearing the cells as it
+ * goes: the coverage of a pixel is the magnitude of the running sum of the
+ * cells up to it, starting from sum, scaled by 0xff / 0x10000 so that
+ * 1 << 16 is full coverage. Returns the sum at the end of the row.
+ */
+typedef int32_t twin_cover_func(twin_a8_t *dst,
+                                int32_t *cells,
+                                int width,
+                                int32_t sum);
+
+twin_cover_func _twin_cover_span;
+
 /* Geometrical objects */
 typedef struct _twin_spoint {
     twin_sfixed_t x, y;
@@ -211,8 +224,14 @@ struct _twin_path {
     int size_sublen;
     int nsublen;
     twin_state_t state;
+    twin_arena_t *arena; /* owns the path and its storage, if set */
 };
 
+static inline twin_font_t *_twin_path_font(const twin_path_t *path)
+{
+    return path->state.font ? path->state.font : g_twin_font;
+}
+
 typedef struct _twin_gpoint {
     twin_gfixed_t x, y;
 } twin_gpoint_t;
@@ -345,9 +364,35 @@ twin_op_func _twin_rgb16_source_a8;
 twin_op_func _twin_a8_source_a8;
 twin_op_func _twin_c_source_a8;
 
+/*
+ * Vectorized kernels for ARGB32 destinations, indexed like the comp2 and
+ * comp3 tables in draw.c: [operator][source][mask], with 3 standing for a
+ * constant operand. Missing entries are NULL and keep the scalar kernel.
+ */
+typedef struct _twin_simd_ops {
+    twin_src_op comp2[2][4];
+    twin_src_msk_op comp3[2][4][4];
+    twin_cover_func *cover;
+} twin_simd_ops_t;
+
+#if defined(CONFIG_SIMD) && (defined(__x86_64__) || defined(__i386__))
+#define TWIN_HAVE_X86_SIMD 1
+extern const twin_simd_ops_t _twin_sse2_ops;
+extern const twin_simd_ops_t _twin_avx2_ops;
+#endif
+
+/* primitive-simd.c */
+
+const twin_simd_ops_t *_twin_simd_ops(void);
+
 twin_op_func _twin_vec_argb32_over_argb32;
 twin_op_func _twin_vec_argb32_source_argb32;
 
+int32_t _twin_vec_cover_span(twin_a8_t *dst,
+                             int32_t *cells,
+                             int width,
+                             int32_t sum);
+
 twin_argb32_t *_twin_fetch_rgb16(twin_pixmap_t *pixmap,
                                  int x,
                                  int y,
@@ -360,6 +405,45 @@ twin_argb32_t *_twin_fetch_argb32(twin_pixmap_t *pixmap,
                                   int w,
                                   twin_argb32_t *span);
 
+/* draw.c */
+
+/*
+ * Composite one row of A8 coverage to dst, clipped like twin_composite but
+ * leaving damage to the caller
+ */
+void _twin_composite_span(twin_pixmap_t *dst,
+                          twin_coord_t dst_x,
+                          twin_coord_t dst_y,
+                          twin_operand_t *src,
+                          twin_coord_t src_x,
+                          twin_coord_t src_y,
+                          twin_a8_t *coverage,
+                          twin_operator_t operator,
+                          twin_coord_t width);
+
+/* Set up a pixmap over caller owned pixels, as twin_pixmap_create_const */
+void _twin_pixmap_init_const(twin_pixmap_t *pixmap,
+                             twin_format_t format,
+                             twin_coord_t width,
+                             twin_coord_t height,
+                             twin_coord_t stride,
+                             twin_pointer_t pixels);
+
+/*
+ * Opaque area bookkeeping for drawing operations, in pixmap coordinates
+ */
+void _twin_pixmap_opaque_add(twin_pixmap_t *pixmap,
+                             twin_coord_t left,
+                             twin_coord_t top,
+                             twin_coord_t right,
+                             twin_coord_t bottom);
+
+void _twin_pixmap_opaque_remove(twin_pixmap_t *pixmap,
+                                twin_coord_t left,
+                                twin_coord_t top,
+                                twin_coord_t right,
+                                twin_coord_t bottom);
+
 /*
  * Geometry helper functions
  */
@@ -428,10 +512,74 @@ void _twin_path_scurve(twin_path_t *path,
 
 void _twin_path_sfinish(twin_path_t *path);
 
+/* A path for work done on behalf of path, sharing its arena if it has one */
+twin_path_t *_twin_path_create_scratch(const twin_path_t *path);
+
+/* poly.c */
+
+/*
+ * Storage kept from one operation to the next, which grows to the largest
+ * size reserved and is never shrunk
+ */
+typedef struct _twin_scratch {
+    void *data;
+    size_t size;
+} twin_scratch_t;
+
+void *_twin_scratch_reserve(twin_scratch_t *scratch, size_t size);
+
+/*
+ * Called as each row of a fill is finished with the pixmap columns
+ * [left, right) which may hold coverage
+ */
+typedef void (*twin_row_proc_t)(twin_coord_t y,
+                                twin_coord_t left,
+                                twin_coord_t right,
+                                void *closure);
+
+void _twin_fill_path_rows(twin_pixmap_t *pixmap,
+                          twin_path_t *path,
+                          twin_coord_t dx,
+                          twin_coord_t dy,
+                          twin_row_proc_t row,
+                          void *closure);
+
+/* Antialiasing of new paths, chosen at configuration time */
+#if defined(CONFIG_RASTERIZER_COVERAGE)
+#define TWIN_ANTIALIAS_DEFAULT TwinAntialiasArea
+#else
+#define TWIN_ANTIALIAS_DEFAULT TwinAntialias4x4
+#endif
+
+/* poly-cover.c */
+
+void _twin_cover_fill_path(twin_pixmap_t *pixmap,
+                           twin_path_t *path,
+                           twin_sfixed_t dx,
+                           twin_sfixed_t dy,
+                           twin_row_proc_t row,
+                           void *closure);
+
 /*
  * Glyph stuff.  Coordinates are stored in 2.6 fixed point format
  */
 
+int _twin_utf8_to_ucs4(const char *src_orig, twin_ucs4_t *dst);
+
+twin_fixed_t _twin_text_metrics_add(twin_text_metrics_t *m,
+                                    twin_text_metrics_t *c,
+                                    twin_fixed_t w,
+                                    bool first);
+
+void _twin_glyph_cache_purge(const twin_font_t *font);
+
+const twin_font_strike_t *_twin_font_strike(const twin_font_t *font,
+                                            const twin_path_t *path);
+
+const twin_font_bitmap_t *_twin_font_strike_bitmap(
+    const twin_font_strike_t *strike,
+    twin_ucs4_t ucs4);
+
 /*
  * Check these whenever glyphs are changed
  */
@@ -458,11 +606,14 @@ typedef struct _twin_queue {
 } twin_queue_t;
 
 struct _twin_timeout {
-    twin_queue_t queue;
-    twin_time_t time;
+    int index;       /* slot in the timeout heap, -1 when not queued */
+    uint32_t serial; /* arming order, breaks ties between equal expiries */
+    int64_t time;    /* expiry in microseconds on the monotonic clock */
     twin_time_t delay;
     twin_timeout_proc_t proc;
     void *closure;
+    bool running; /* its proc is being called */
+    bool cleared; /* cleared from inside its own proc */
 };
 
 struct _twin_work {
@@ -473,11 +624,15 @@ struct _twin_work {
 };
 
 struct _twin_file {
-    twin_queue_t queue;
+    struct _twin_file *next; /* cleared while dispatching, to be freed */
+    struct _twin_file *same; /* next file set on the same descriptor */
+    int index;               /* slot in the file table */
     int file;
     twin_file_op_t ops;
     twin_file_proc_t proc;
     void *closure;
+    bool always;  /* cannot be polled, as regular files are always ready */
+    bool deleted; /* cleared while dispatching */
 };
 
 typedef enum _twin_order {
@@ -504,7 +659,9 @@ twin_queue_t *_twin_queue_set_order(twin_queue_t **head);
 
 void _twin_queue_review_order(twin_queue_t *first);
 
-int _twin_run_file(twin_time_t delay);
+bool _twin_file_init(void);
+
+void _twin_run_file(twin_time_t delay);
 
 void _twin_run_timeout(void);
 
@@ -512,6 +669,8 @@ twin_time_t _twin_timeout_delay(void);
 
 void _twin_run_work(void);
 
+bool _twin_work_pending(void);
+
 void _twin_box_init(twin_box_t *box,
                     twin_box_t *parent,
                     twin_window_t *window,
@@ -0,0 +1,73 @@
+/*
+ * Twin - A Tiny Window System
+ * Copyright (c) 2024 National Cheng Kung University, Taiwan
+ * All rights reserved.
+ */
+
+#include <stdlib.h>
+
+#include "twin_private.h"
+
+/*
+ * Chunks are chained newest first, each at least twice the size of the
+ * one before, so a reset can keep just the newest and still hold most of
+ * what the last cycle used.
+ */
+struct _twin_arena_chunk {
+    twin_arena_chunk_t *next;
+    size_t size;
+    size_t used;
+};
+
+#define TWIN_ARENA_ALIGN 16
+#define TWIN_ARENA_MIN 4096
+#define TWIN_ARENA_ROUND(n) \
+    (((n) + TWIN_ARENA_ALIGN - 1) & ~(size_t) (TWIN_ARENA_ALIGN - 1))
+#define TWIN_ARENA_HEADER TWIN_ARENA_ROUND(sizeof(twin_arena_chunk_t))
+
+void *twin_arena_alloc(twin_arena_t *arena, size_t size)
+{
+    twin_arena_chunk_t *chunk = arena->chunks;
+    void *data;
+
+    size = TWIN_ARENA_ROUND(size);
+    if (!chunk || chunk->size - chunk->used < size) {
+        size_t grow = chunk ? chunk->size * 2 : TWIN_ARENA_MIN;
+
+        while (grow < size)
+            grow *= 2;
+        chunk = malloc(TWIN_ARENA_HEADER + grow);
+        if (!chunk)
+            return NULL;
+        chunk->next = arena->chunks;
+        chunk->size = grow;
+        chunk->used = 0;
+        arena->chunks = chunk;
+    }
+    data = (uint8_t *) chunk + TWIN_ARENA_HEADER + chunk->used;
+    chunk->used += size;
+    return data;
+}
+
+void twin_arena_reset(twin_arena_t *arena)
+{
+    twin_arena_chunk_t *chunk = arena->chunks, *old;
+
+    if (!chunk)
+        return;
+    while ((old = chunk->next)) {
+        chunk->next = old->next;
+        free(old);
+    }
+    chunk->used = 0;
+}
+
+void twin_arena_fini(twin_arena_t *arena)
+{
+    twin_arena_chunk_t *chunk;
+
+    while ((chunk = arena->chunks)) {
+        arena->chunks = chunk->next;
+        free(chunk);
+    }
+}
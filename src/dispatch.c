@@ -6,12 +6,30 @@
 
 #include "twin_private.h"
 
+static volatile bool dispatch_exit;
+
+/*
+ * Nothing spins while the screen is idle: backends queue their redisplay
+ * work only once the screen is damaged, so with no work queued the loop
+ * sleeps until a file is ready, the next timeout is due or someone calls
+ * twin_wakeup().
+ */
 void twin_dispatch(void)
 {
+    _twin_file_init();
+    dispatch_exit = false;
     for (;;) {
         _twin_run_timeout();
         _twin_run_work();
-        if (!_twin_run_file(_twin_timeout_delay()))
+        if (dispatch_exit)
             break;
+        /* queued work runs again next pass, so only check the files */
+        _twin_run_file(_twin_work_pending() ? 0 : _twin_timeout_delay());
     }
 }
+
+void twin_dispatch_exit(void)
+{
+    dispatch_exit = true;
+    twin_wakeup();
+}
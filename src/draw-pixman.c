@@ -83,8 +83,14 @@ void twin_composite(twin_pixmap_t *_dst,
         twin_pixmap_t *src_pixmap = _src->u.pixmap;
         src = create_pixman_image_from_twin_pixmap(src_pixmap);
 
-        if (!twin_matrix_is_identity(&(src_pixmap->transform)))
+        if (!twin_matrix_is_identity(&(src_pixmap->transform))) {
             pixmap_matrix_scale(src, &(src_pixmap->transform));
+            pixman_image_set_filter(src,
+                                    src_pixmap->filter == TWIN_FILTER_NEAREST
+                                        ? PIXMAN_FILTER_NEAREST
+                                        : PIXMAN_FILTER_BILINEAR,
+                                    NULL, 0);
+        }
     }
 
     pixman_image_t *dst = create_pixman_image_from_twin_pixmap(_dst);
@@ -107,6 +113,10 @@ void twin_composite(twin_pixmap_t *_dst,
         pixman_image_unref(msk);
     }
 
+    /* OVER never makes pixels translucent; SOURCE may */
+    if (operator == TWIN_SOURCE)
+        _twin_pixmap_opaque_remove(_dst, ox, oy, ox + width, oy + height);
+
     pixman_image_unref(src);
     pixman_image_unref(dst);
 }
@@ -142,6 +152,10 @@ void twin_fill(twin_pixmap_t *_dst,
         twin_to_pixman_op(operator), dst, &color, 1,
         &(pixman_rectangle16_t){left, top, right - left, bottom - top});
 
+    if ((pixel >> 24) == 0xff)
+        _twin_pixmap_opaque_add(_dst, left, top, right, bottom);
+    else if (operator == TWIN_SOURCE)
+        _twin_pixmap_opaque_remove(_dst, left, top, right, bottom);
     twin_pixmap_damage(_dst, left, top, right, bottom);
 
     pixman_image_unref(dst);
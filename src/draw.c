@@ -15,7 +15,7 @@
 #include "twin_private.h"
 
 /* op, src, dst */
-static const twin_src_op comp2[2][4][3] = {
+static twin_src_op comp2[2][4][3] = {
     [TWIN_OVER] =
         {
             [TWIN_A8] =
@@ -73,7 +73,7 @@ static const twin_src_op comp2[2][4][3] = {
 };
 
 /* op, src, msk, dst */
-static const twin_src_msk_op comp3[2][4][4][3] = {
+static twin_src_msk_op comp3[2][4][4][3] = {
     [TWIN_OVER] =
         {
             [TWIN_A8] =
@@ -298,143 +298,92 @@ static const twin_src_msk_op comp3[2][4][4][3] = {
         },
 };
 
+/*
+ * array primary    index is OVER SOURCE
+ * array secondary  index is ARGB32 RGB16 A8
+ */
+static twin_src_op fill[2][3] = {
+    [TWIN_OVER] =
+        {
+            _twin_c_over_a8,
+            _twin_c_over_rgb16,
+            _twin_c_over_argb32,
+        },
+    [TWIN_SOURCE] =
+        {
+            _twin_c_source_a8,
+            _twin_c_source_rgb16,
+            _twin_c_source_argb32,
+        },
+};
 
-#define operand_index(o) \
-    ((o)->source_kind == TWIN_SOLID ? 3 : o->u.pixmap->format)
-
-#define _twin_add_ARGB(s, d, i, t) (((t) = (s) + twin_get_8(d, i)))
-#define _twin_add(s, d, t) (((t) = (s) + (d)))
-#define _twin_div(d, i, t)                      \
-    (((t) = (d) / 9), (t) = twin_get_8((t), 0), \
-     (twin_argb32_t) twin_sat(t) << (i))
-#define _twin_sub_ARGB(s, d, i, t) (((t) = (s) - twin_get_8(d, i)))
-#define _twin_sub(s, d, t) (((t) = (s) - (d)))
-#define twin_put_8(d, i, t) (((t) = (d) << (i)))
-
-#define min(x, y)            \
-    ({                       \
-        typeof(x) _x = (x);  \
-        typeof(y) _y = (y);  \
-        (void) (&_x == &_y); \
-        _x < _y ? _x : _y;   \
-    })
-#define max(x, y)            \
-    ({                       \
-        typeof(x) _x = (x);  \
-        typeof(y) _y = (y);  \
-        (void) (&_x == &_y); \
-        _x > _y ? _x : _y;   \
-    })
-
-void twin_stack(twin_pixmap_t *trg_px, twin_pixmap_t *src_px, bool horiz_span)
+/*
+ * Replace the ARGB32 destination entries of comp2, comp3 and fill with the
+ * vector kernels the CPU supports. Runs once, before the first operation.
+ */
+static void _twin_composite_init(void)
 {
-    int first_num, second_num, radius = 2;
-    twin_pointer_t src_ptr, trg_ptr, old_ptr, new_ptr;
-    twin_argb32_t sumInR, sumOutR, sumR, sumInG, sumOutG, sumG, sumInB, sumOutB,
-        sumB, _cur, _old, _new, _src;
-    uint16_t t1, t2, t3, t4;
-    first_num = src_px->height, second_num = src_px->width;
-    for (int first = 0; first < first_num; first++) {
-        /* padding sum_out */
-        sumInR = sumOutR = sumR = sumInG = sumOutG = sumG = sumInB = sumOutB =
-            sumB = 0x00000000;
-
-        for (int i = 0; i < radius; i++) {
-            if (horiz_span)
-                src_ptr = twin_pixmap_pointer(src_px, 0, first);
-            else
-                src_ptr = twin_pixmap_pointer(src_px, first, 0);
-            _src = *src_ptr.argb32;
-            sumOutR = _twin_add_ARGB(sumOutR, _src, 0, t1);
-            sumOutG = _twin_add_ARGB(sumOutG, _src, 8, t2);
-            sumOutB = _twin_add_ARGB(sumOutB, _src, 16, t3);
-            for (int j = 0; j < i + 1; j++) {
-                sumR = _twin_add_ARGB(sumR, _src, 0, t1);
-                sumG = _twin_add_ARGB(sumG, _src, 8, t2);
-                sumB = _twin_add_ARGB(sumB, _src, 16, t3);
-            }
-        }
+    static bool initialized;
+    const twin_simd_ops_t *simd;
 
-        for (int i = 0; i < radius; i++) {
-            if (horiz_span)
-                src_ptr = twin_pixmap_pointer(src_px, i, first);
-            else
-                src_ptr = twin_pixmap_pointer(src_px, first, i);
-            _src = *src_ptr.argb32;
-            sumInR = _twin_add_ARGB(sumInR, _src, 0, t1);
-            sumInG = _twin_add_ARGB(sumInG, _src, 8, t2);
-            sumInB = _twin_add_ARGB(sumInB, _src, 16, t3);
-            for (int j = 0; j < radius - i; j++) {
-                sumR = _twin_add_ARGB(sumR, _src, 0, t1);
-                sumG = _twin_add_ARGB(sumG, _src, 8, t2);
-                sumB = _twin_add_ARGB(sumB, _src, 16, t3);
-            }
-        }
+    if (initialized)
+        return;
+    initialized = true;
+
+    simd = _twin_simd_ops();
+    if (!simd)
+        return;
 
-        for (int cur = 0; cur < second_num; cur++) {
-            if (horiz_span) {
-                src_ptr = twin_pixmap_pointer(src_px, cur, first);
-                trg_ptr = twin_pixmap_pointer(trg_px, cur, first);
-                old_ptr =
-                    twin_pixmap_pointer(src_px, max(cur - radius, 0), first);
-                new_ptr = twin_pixmap_pointer(
-                    src_px, min(cur + radius, second_num - 1), first);
-            } else {
-                src_ptr = twin_pixmap_pointer(src_px, first, cur);
-                trg_ptr = twin_pixmap_pointer(trg_px, first, cur);
-                old_ptr =
-                    twin_pixmap_pointer(src_px, first, max(cur - radius, 0));
-                new_ptr = twin_pixmap_pointer(
-                    src_px, first, min(cur + radius, second_num - 1));
-            }
-            _cur = *src_ptr.argb32;
-            _old = *old_ptr.argb32;
-            _new = *new_ptr.argb32;
-            /* STEP 1 : sum_out + current */
-            sumOutR = _twin_add_ARGB(sumOutR, _cur, 0, t1);
-            sumOutG = _twin_add_ARGB(sumOutG, _cur, 8, t2);
-            sumOutB = _twin_add_ARGB(sumOutB, _cur, 16, t3);
-            /* STEP 2 : sum_in + new */
-            sumInR = _twin_add_ARGB(sumInR, _new, 0, t1);
-            sumInG = _twin_add_ARGB(sumInG, _new, 8, t2);
-            sumInB = _twin_add_ARGB(sumInB, _new, 16, t3);
-            /* STEP 3: sum + sum_in */
-            sumR = _twin_add(sumR, sumInR, t1);
-            sumG = _twin_add(sumG, sumInG, t2);
-            sumB = _twin_add(sumB, sumInB, t3);
-            /* STEP 4 : sum / 9 */
-            *trg_ptr.argb32 =
-                (_twin_div(sumR, 0, t1) | _twin_div(sumG, 8, t2) |
-                 _twin_div(sumB, 16, t3) | (*src_ptr.argb32 & 0xff000000));
-            /* STEP 5 : sum - sum_out */
-            sumR = _twin_sub(sumR, sumOutR, t1);
-            sumG = _twin_sub(sumG, sumOutG, t2);
-            sumB = _twin_sub(sumB, sumOutB, t3);
-            /* STEP 6 : sum_out - old */
-            sumOutR = _twin_sub_ARGB(sumOutR, _old, 0, t1);
-            sumOutG = _twin_sub_ARGB(sumOutG, _old, 8, t2);
-            sumOutB = _twin_sub_ARGB(sumOutB, _old, 16, t3);
-            /* STEP 7 : sum_in - source_current */
-            sumInR = _twin_sub_ARGB(sumInR, _cur, 0, t1);
-            sumInG = _twin_sub_ARGB(sumInG, _cur, 8, t2);
-            sumInB = _twin_sub_ARGB(sumInB, _cur, 16, t3);
+    for (int op = TWIN_OVER; op <= TWIN_SOURCE; op++) {
+        for (int s = 0; s < 4; s++) {
+            if (simd->comp2[op][s])
+                comp2[op][s][TWIN_ARGB32] = simd->comp2[op][s];
+            for (int m = 0; m < 4; m++)
+                if (simd->comp3[op][s][m])
+                    comp3[op][s][m][TWIN_ARGB32] = simd->comp3[op][s][m];
         }
+        fill[op][TWIN_ARGB32] = comp2[op][3][TWIN_ARGB32];
     }
 }
 
-void twin_stack_blur(twin_pixmap_t *px)
+#define operand_index(o) \
+    ((o)->source_kind == TWIN_SOLID ? 3 : o->u.pixmap->format)
+
+/*
+ * Whether an operand is known to be opaque over left..right x top..bottom,
+ * given in the operand pixmap coordinates
+ */
+static bool _twin_operand_opaque(twin_operand_t *o,
+                                 twin_coord_t left,
+                                 twin_coord_t top,
+                                 twin_coord_t right,
+                                 twin_coord_t bottom)
 {
-    if (px->format != TWIN_ARGB32)
-        return;
-    twin_pixmap_t *tmp_px =
-        twin_pixmap_create(px->format, px->width, px->height);
-    memcpy(tmp_px->p.v, px->p.v,
-           px->width * px->height * twin_bytes_per_pixel(px->format));
-
-    twin_stack(tmp_px, px, true);
-    twin_stack(px, tmp_px, false);
-    twin_pixmap_destroy(tmp_px);
-    return;
+    const twin_rect_t *r;
+
+    if (o->source_kind == TWIN_SOLID)
+        return (o->u.argb >> 24) == 0xff;
+    r = &o->u.pixmap->opaque;
+    return r->left <= left && right <= r->right && r->top <= top &&
+           bottom <= r->bottom;
+}
+
+/*
+ * Account for a drawing operation in the opaque area of dst: opaque
+ * results grow it, OVER never shrinks it and SOURCE otherwise may.
+ */
+static void _twin_update_opaque(twin_pixmap_t *dst,
+                                twin_operator_t operator,
+                                bool opaque,
+                                twin_coord_t left,
+                                twin_coord_t top,
+                                twin_coord_t right,
+                                twin_coord_t bottom)
+{
+    if (opaque)
+        _twin_pixmap_opaque_add(dst, left, top, right, bottom);
+    else if (operator == TWIN_SOURCE)
+        _twin_pixmap_opaque_remove(dst, left, top, right, bottom);
 }
 
 /* FIXME: source clipping is busted */
@@ -455,6 +404,7 @@ static void _twin_composite_simple(twin_pixmap_t *dst,
     twin_coord_t left, top, right, bottom;
     twin_coord_t sdx, sdy;
     twin_source_u s;
+    bool opaque;
 
     dst_x += dst->origin_x;
     dst_y += dst->origin_y;
@@ -484,6 +434,8 @@ static void _twin_composite_simple(twin_pixmap_t *dst,
 
     sdx = src_x - dst_x;
     sdy = src_y - dst_y;
+    opaque = _twin_operand_opaque(src, left + sdx, top + sdy, right + sdx,
+                                  bottom + sdy);
 
     if (msk) {
         twin_src_msk_op op;
@@ -498,6 +450,10 @@ static void _twin_composite_simple(twin_pixmap_t *dst,
 
         mdx = msk_x - dst_x;
         mdy = msk_y - dst_y;
+        opaque = opaque && _twin_operand_opaque(msk, left + mdx, top + mdy,
+                                                right + mdx, bottom + mdy);
+        if (opaque)
+            operator = TWIN_SOURCE;
 
     op = comp3[operator][operand_index(src)][operand_index(msk)][dst->format];
     for (iy = top; iy < bottom; iy++) {
@@ -510,6 +466,9 @@ static void _twin_composite_simple(twin_pixmap_t *dst,
     } else {
         twin_src_op op;
 
+    /* an opaque source covers the destination outright */
+    if (opaque)
+        operator = TWIN_SOURCE;
     op = comp2[operator][operand_index(src)][dst->format];
 
     for (iy = top; iy < bottom; iy++) {
@@ -518,6 +477,7 @@ static void _twin_composite_simple(twin_pixmap_t *dst,
         (*op)(twin_pixmap_pointer(dst, left, iy), s, right - left);
     }
     }
+    _twin_update_opaque(dst, operator, opaque, left, top, right, bottom);
     twin_pixmap_damage(dst, left, top, right, bottom);
 }
 
@@ -568,34 +528,43 @@ static void twin_pixmap_free_xform(twin_xform_t *xform)
  * here. source clipping is useful if you try to extract one image
  * out of a big picture though.
  */
-#define _pix_clipped(pix, x, y)                                    \
-    ((x) < FX((pix)->clip.left) || (x) >= FX((pix)->clip.right) || \
-     (y) < FX((pix)->clip.top) || (y) >= FX((pix)->clip.bottom))
-
-#define _get_pix_8(d, pix, x, y)                                    \
-    do {                                                            \
-        (d) = _pix_clipped(pix, x, y)                               \
-                  ? 0                                               \
-                  : *((pix)->p.a8 + XF(y) * (pix)->stride + XF(x)); \
-    } while (0)
-
-#define _get_pix_16(d, pix, x, y)                                            \
-    do {                                                                     \
-        twin_rgb16_t p =                                                     \
-            _pix_clipped(pix, x, y)                                          \
-                ? 0                                                          \
-                : *((pix)->p.argb32 + XF(y) * ((pix)->stride >> 1) + XF(x)); \
-        *((twin_argb32_t *) (char *) (d)) = twin_rgb16_to_argb32(p);         \
-    } while (0)
-
-#define _get_pix_32(d, pix, x, y)                                            \
-    do {                                                                     \
-        twin_argb32_t p =                                                    \
-            _pix_clipped(pix, x, y)                                          \
-                ? 0                                                          \
-                : *((pix)->p.argb32 + XF(y) * ((pix)->stride >> 2) + XF(x)); \
-        *((twin_argb32_t *) (char *) (d)) = p;                               \
-    } while (0)
+static inline bool _pix_clipped(const twin_pixmap_t *pix, int x, int y)
+{
+    return x < pix->clip.left || x >= pix->clip.right || y < pix->clip.top ||
+           y >= pix->clip.bottom;
+}
+
+/* Fetch a texel, widened to ARGB32 unless the pixmap is A8 */
+static inline twin_argb32_t _row_texel(const uint8_t *row,
+                                       twin_format_t format,
+                                       int x)
+{
+    switch (format) {
+    case TWIN_A8:
+        return row[x];
+    case TWIN_RGB16:
+        return twin_rgb16_to_argb32(((const twin_rgb16_t *) row)[x]);
+    case TWIN_ARGB32:
+    default:
+        return ((const twin_argb32_t *) row)[x];
+    }
+}
+
+static inline twin_argb32_t _pix_texel(const twin_pixmap_t *pix,
+                                       twin_format_t format,
+                                       int x,
+                                       int y)
+{
+    return _row_texel(pix->p.b + y * pix->stride, format, x);
+}
+
+static inline twin_argb32_t _pix_texel_clipped(const twin_pixmap_t *pix,
+                                               twin_format_t format,
+                                               int x,
+                                               int y)
+{
+    return _pix_clipped(pix, x, y) ? 0 : _pix_texel(pix, format, x, y);
+}
 
 #define _pix_saucemix(tl, tr, bl, br, wx, wy)                     \
     ((((((br * wx) + (bl * (TWIN_FIXED_ONE - wx))) >> 16) * wy) + \
@@ -603,100 +572,197 @@ static void twin_pixmap_free_xform(twin_xform_t *xform)
        (TWIN_FIXED_ONE - wy))) >>                                 \
      16)
 
-static void twin_pixmap_read_xform_8(twin_xform_t *xform, twin_coord_t line)
+static inline twin_argb32_t _pix_bilinear(twin_format_t format,
+                                          twin_argb32_t tl,
+                                          twin_argb32_t tr,
+                                          twin_argb32_t bl,
+                                          twin_argb32_t br,
+                                          unsigned int wx,
+                                          unsigned int wy)
 {
-    twin_fixed_t dx, dy, sx, sy;
-    unsigned int wx, wy;
-    twin_a8_t pts[4];
-    twin_a8_t *dst = xform->span.a8;
-    twin_pixmap_t *pix = xform->pixmap;
-    twin_matrix_t *tfm = &xform->pixmap->transform;
-
-    /* for each row in the dest line */
-    dy = twin_int_to_fixed(line);
-    for (dx = 0; dx < twin_int_to_fixed(xform->width); dx += TWIN_FIXED_ONE) {
-        sx = _twin_matrix_fx(tfm, dx, dy) + FX(xform->src_x);
-        sy = _twin_matrix_fy(tfm, dx, dy) + FX(xform->src_y);
-        _get_pix_8(pts[0], pix, sx, sy);
-        _get_pix_8(pts[1], pix, sx + TWIN_FIXED_ONE, sy);
-        _get_pix_8(pts[2], pix, sx, sy + TWIN_FIXED_ONE);
-        _get_pix_8(pts[3], pix, sx + TWIN_FIXED_ONE, sy + TWIN_FIXED_ONE);
-        wx = sx & 0xffff;
-        wy = sy & 0xffff;
-        *(dst++) = _pix_saucemix(pts[0], pts[1], pts[2], pts[3], wx, wy);
+    twin_argb32_t v = 0;
+
+    if (format == TWIN_A8)
+        return _pix_saucemix(tl, tr, bl, br, wx, wy);
+    for (int i = 0; i < 32; i += 8)
+        v |= (twin_argb32_t) _pix_saucemix(twin_get_8(tl, i), twin_get_8(tr, i),
+                                           twin_get_8(bl, i), twin_get_8(br, i),
+                                           wx, wy)
+             << i;
+    return v;
+}
+
+static inline void _pix_store(twin_pointer_t *dst,
+                              twin_format_t format,
+                              twin_argb32_t v)
+{
+    if (format == TWIN_A8)
+        *dst->a8++ = v;
+    else
+        *dst->argb32++ = v;
+}
+
+/*
+ * Sample 'n' destination pixels starting at source position (sx, sy),
+ * stepping by (ddx, ddy) per pixel. Spans known to stay inside the clip
+ * pass check = false and run without any bounds tests.
+ */
+static inline void _twin_xform_span(const twin_pixmap_t *pix,
+                                    twin_format_t format,
+                                    twin_filter_t filter,
+                                    bool check,
+                                    twin_pointer_t *dst,
+                                    int n,
+                                    twin_fixed_t sx,
+                                    twin_fixed_t sy,
+                                    twin_fixed_t ddx,
+                                    twin_fixed_t ddy)
+{
+    twin_argb32_t tl, tr, bl, br;
+    int x, y;
+
+    for (; n > 0; n--, sx += ddx, sy += ddy) {
+        if (filter == TWIN_FILTER_NEAREST) {
+            x = XF(sx + TWIN_FIXED_HALF);
+            y = XF(sy + TWIN_FIXED_HALF);
+            _pix_store(dst, format,
+                       check ? _pix_texel_clipped(pix, format, x, y)
+                             : _pix_texel(pix, format, x, y));
+            continue;
+        }
+        x = XF(sx);
+        y = XF(sy);
+        if (check) {
+            tl = _pix_texel_clipped(pix, format, x, y);
+            tr = _pix_texel_clipped(pix, format, x + 1, y);
+            bl = _pix_texel_clipped(pix, format, x, y + 1);
+            br = _pix_texel_clipped(pix, format, x + 1, y + 1);
+        } else {
+            tl = _pix_texel(pix, format, x, y);
+            tr = _pix_texel(pix, format, x + 1, y);
+            bl = _pix_texel(pix, format, x, y + 1);
+            br = _pix_texel(pix, format, x + 1, y + 1);
+        }
+        _pix_store(dst, format,
+                   _pix_bilinear(format, tl, tr, bl, br, sx & 0xffff,
+                                 sy & 0xffff));
     }
 }
 
-static void twin_pixmap_read_xform_16(twin_xform_t *xform, twin_coord_t line)
+/*
+ * Pure scaling keeps the source row fixed along a destination row: fetch
+ * the two row pointers and the vertical weight once, step x alone.
+ */
+static inline void _twin_xform_span_scale(const twin_pixmap_t *pix,
+                                          twin_format_t format,
+                                          twin_filter_t filter,
+                                          twin_pointer_t *dst,
+                                          int n,
+                                          twin_fixed_t sx,
+                                          twin_fixed_t sy,
+                                          twin_fixed_t ddx)
 {
-    twin_fixed_t dx, dy, sx, sy;
-    unsigned int wx, wy;
-    twin_a8_t pts[4][4];
-    twin_a8_t *dst = xform->span.a8;
-    twin_pixmap_t *pix = xform->pixmap;
-    twin_matrix_t *tfm = &xform->pixmap->transform;
-
-    /* for each row in the dest line */
-    dy = twin_int_to_fixed(line);
-    for (dx = 0; dx < twin_int_to_fixed(xform->width); dx += TWIN_FIXED_ONE) {
-        sx = _twin_matrix_fx(tfm, dx, dy) + FX(xform->src_x);
-        sy = _twin_matrix_fy(tfm, dx, dy) + FX(xform->src_y);
-        _get_pix_16(pts[0], pix, sx, sy);
-        _get_pix_16(pts[1], pix, sx + TWIN_FIXED_ONE, sy);
-        _get_pix_16(pts[2], pix, sx, sy + TWIN_FIXED_ONE);
-        _get_pix_16(pts[3], pix, sx + TWIN_FIXED_ONE, sy + TWIN_FIXED_ONE);
-        wx = sx & 0xffff;
-        wy = sy & 0xffff;
-        *(dst++) =
-            _pix_saucemix(pts[0][0], pts[1][0], pts[2][0], pts[3][0], wx, wy);
-        *(dst++) =
-            _pix_saucemix(pts[0][1], pts[1][1], pts[2][1], pts[3][1], wx, wy);
-        *(dst++) =
-            _pix_saucemix(pts[0][2], pts[1][2], pts[2][2], pts[3][2], wx, wy);
-        *(dst++) =
-            _pix_saucemix(pts[0][3], pts[1][3], pts[2][3], pts[3][3], wx, wy);
+    const uint8_t *row0, *row1;
+    unsigned int wy = sy & 0xffff;
+    twin_argb32_t tl, tr, bl, br;
+    int x;
+
+    if (filter == TWIN_FILTER_NEAREST) {
+        row0 = pix->p.b + XF(sy + TWIN_FIXED_HALF) * pix->stride;
+        for (; n > 0; n--, sx += ddx)
+            _pix_store(dst, format,
+                       _row_texel(row0, format, XF(sx + TWIN_FIXED_HALF)));
+        return;
+    }
+    row0 = pix->p.b + XF(sy) * pix->stride;
+    row1 = row0 + pix->stride;
+    for (; n > 0; n--, sx += ddx) {
+        x = XF(sx);
+        tl = _row_texel(row0, format, x);
+        tr = _row_texel(row0, format, x + 1);
+        bl = _row_texel(row1, format, x);
+        br = _row_texel(row1, format, x + 1);
+        _pix_store(dst, format,
+                   _pix_bilinear(format, tl, tr, bl, br, sx & 0xffff, wy));
     }
 }
 
-static void twin_pixmap_read_xform_32(twin_xform_t *xform, twin_coord_t line)
+static inline int64_t _floor_div(int64_t a, int64_t b)
 {
-    twin_fixed_t dx, dy, sx, sy;
-    unsigned int wx, wy;
-    twin_a8_t pts[4][4];
-    twin_a8_t *dst = xform->span.a8;
-    twin_pixmap_t *pix = xform->pixmap;
-    twin_matrix_t *tfm = &xform->pixmap->transform;
-
-    /* for each row in the dest line */
-    dy = twin_int_to_fixed(line);
-    for (dx = 0; dx < twin_int_to_fixed(xform->width); dx += TWIN_FIXED_ONE) {
-        sx = _twin_matrix_fx(tfm, dx, dy) + FX(xform->src_x);
-        sy = _twin_matrix_fy(tfm, dx, dy) + FX(xform->src_y);
-        _get_pix_32(pts[0], pix, sx, sy);
-        _get_pix_32(pts[1], pix, sx + TWIN_FIXED_ONE, sy);
-        _get_pix_32(pts[2], pix, sx, sy + TWIN_FIXED_ONE);
-        _get_pix_32(pts[3], pix, sx + TWIN_FIXED_ONE, sy + TWIN_FIXED_ONE);
-        wx = sx & 0xffff;
-        wy = sy & 0xffff;
-        *(dst++) =
-            _pix_saucemix(pts[0][0], pts[1][0], pts[2][0], pts[3][0], wx, wy);
-        *(dst++) =
-            _pix_saucemix(pts[0][1], pts[1][1], pts[2][1], pts[3][1], wx, wy);
-        *(dst++) =
-            _pix_saucemix(pts[0][2], pts[1][2], pts[2][2], pts[3][2], wx, wy);
-        *(dst++) =
-            _pix_saucemix(pts[0][3], pts[1][3], pts[2][3], pts[3][3], wx, wy);
+    return a >= 0 ? a / b : -((-a + b - 1) / b);
+}
+
+/*
+ * Narrow [*lo, *hi) to the steps i for which min <= v + i * d < max.
+ */
+static void _twin_xform_range(int64_t v,
+                              int64_t d,
+                              int64_t min,
+                              int64_t max,
+                              int *lo,
+                              int *hi)
+{
+    int64_t l, h;
+
+    if (d == 0) {
+        if (v < min || v >= max)
+            *hi = *lo;
+        return;
+    }
+    if (d > 0) {
+        l = -_floor_div(v - min, d);
+        h = -_floor_div(v - max, d);
+    } else {
+        l = _floor_div(v - max, -d) + 1;
+        h = _floor_div(v - min, -d) + 1;
     }
+    if (l > *lo)
+        *lo = l < *hi ? l : *hi;
+    if (h < *hi)
+        *hi = h > *lo ? h : *lo;
 }
 
 static void twin_pixmap_read_xform(twin_xform_t *xform, twin_coord_t line)
 {
-    if (xform->pixmap->format == TWIN_A8)
-        twin_pixmap_read_xform_8(xform, line);
-    else if (xform->pixmap->format == TWIN_RGB16)
-        twin_pixmap_read_xform_16(xform, line);
-    else if (xform->pixmap->format == TWIN_ARGB32)
-        twin_pixmap_read_xform_32(xform, line);
+    twin_pixmap_t *pix = xform->pixmap;
+    twin_matrix_t *tfm = &pix->transform;
+    twin_format_t format = pix->format;
+    twin_filter_t filter = pix->filter;
+    twin_pointer_t dst = xform->span;
+    twin_fixed_t dy = twin_int_to_fixed(line);
+    twin_fixed_t ddx = tfm->m[0][0], ddy = tfm->m[0][1];
+    twin_fixed_t sx, sy, bias;
+    int lo = 0, hi = xform->width, margin;
+
+    /* source position of the first pixel; later ones are one step apart */
+    sx = twin_fixed_mul(tfm->m[1][0], dy) + tfm->m[2][0] + FX(xform->src_x);
+    sy = twin_fixed_mul(tfm->m[1][1], dy) + tfm->m[2][1] + FX(xform->src_y);
+
+    /* find the steps whose every tap lands inside the clip */
+    if (filter == TWIN_FILTER_NEAREST) {
+        bias = TWIN_FIXED_HALF;
+        margin = 0;
+    } else {
+        bias = 0;
+        margin = 1;
+    }
+    _twin_xform_range((int64_t) sx + bias, ddx, FX((int64_t) pix->clip.left),
+                      FX((int64_t) pix->clip.right - margin), &lo, &hi);
+    _twin_xform_range((int64_t) sy + bias, ddy, FX((int64_t) pix->clip.top),
+                      FX((int64_t) pix->clip.bottom - margin), &lo, &hi);
+
+    _twin_xform_span(pix, format, filter, true, &dst, lo, sx, sy, ddx, ddy);
+    sx += lo * ddx;
+    sy += lo * ddy;
+    if (ddy == 0)
+        _twin_xform_span_scale(pix, format, filter, &dst, hi - lo, sx, sy, ddx);
+    else
+        _twin_xform_span(pix, format, filter, false, &dst, hi - lo, sx, sy,
+                         ddx, ddy);
+    sx += (hi - lo) * ddx;
+    sy += (hi - lo) * ddy;
+    _twin_xform_span(pix, format, filter, true, &dst, xform->width - hi, sx,
+                     sy, ddx, ddy);
 }
 
 static void _twin_composite_xform(twin_pixmap_t *dst,
@@ -786,6 +852,8 @@ static void _twin_composite_xform(twin_pixmap_t *dst,
         (*op)(twin_pixmap_pointer(dst, left, iy), s, right - left);
     }
     }
+    /* resampled edges may be translucent, so only ever shrink */
+    _twin_update_opaque(dst, operator, false, left, top, right, bottom);
     twin_pixmap_damage(dst, left, top, right, bottom);
     twin_pixmap_free_xform(sxform);
     twin_pixmap_free_xform(mxform);
@@ -804,6 +872,7 @@ void twin_composite(twin_pixmap_t *dst,
                     twin_coord_t width,
                     twin_coord_t height)
 {
+    _twin_composite_init();
     if ((src->source_kind == TWIN_PIXMAP &&
          !twin_matrix_is_identity(&src->u.pixmap->transform)) ||
         (msk && (msk->source_kind == TWIN_PIXMAP &&
@@ -815,6 +884,47 @@ void twin_composite(twin_pixmap_t *dst,
                                msk_y, operator, width, height);
 }
 
+void _twin_composite_span(twin_pixmap_t *dst,
+                          twin_coord_t dst_x,
+                          twin_coord_t dst_y,
+                          twin_operand_t *src,
+                          twin_coord_t src_x,
+                          twin_coord_t src_y,
+                          twin_a8_t *coverage,
+                          twin_operator_t operator,
+                          twin_coord_t width)
+{
+    twin_coord_t left, right;
+    twin_source_u s, m;
+
+    _twin_composite_init();
+    dst_x += dst->origin_x;
+    dst_y += dst->origin_y;
+    left = dst_x;
+    right = dst_x + width;
+
+    /* clip */
+    if (dst_y < dst->clip.top || dst_y >= dst->clip.bottom)
+        return;
+    if (left < dst->clip.left)
+        left = dst->clip.left;
+    if (right > dst->clip.right)
+        right = dst->clip.right;
+    if (left >= right)
+        return;
+
+    if (src->source_kind == TWIN_PIXMAP) {
+        src_x += src->u.pixmap->origin_x + left - dst_x;
+        src_y += src->u.pixmap->origin_y;
+        s.p = twin_pixmap_pointer(src->u.pixmap, src_x, src_y);
+    } else
+        s.c = src->u.argb;
+    m.p.a8 = coverage + left - dst_x;
+
+    (*comp3[operator][operand_index(src)][TWIN_A8][dst->format])(
+        twin_pixmap_pointer(dst, left, dst_y), s, m, right - left);
+}
+
 static twin_argb32_t _twin_apply_alpha(twin_argb32_t v)
 {
     uint16_t t1, t2, t3;
@@ -858,24 +968,6 @@ void twin_premultiply_alpha(twin_pixmap_t *px)
     }
 }
 
-/*
- * array primary    index is OVER SOURCE
- * array secondary  index is ARGB32 RGB16 A8
- */
-static twin_src_op fill[2][3] = {
-    [TWIN_OVER] =
-        {
-            _twin_c_over_a8,
-            _twin_c_over_rgb16,
-            _twin_c_over_argb32,
-        },
-    [TWIN_SOURCE] =
-        {
-            _twin_c_source_a8,
-            _twin_c_source_rgb16,
-            _twin_c_source_argb32,
-        },
-};
 
 void twin_fill(twin_pixmap_t *dst,
                twin_argb32_t pixel,
@@ -888,6 +980,7 @@ void twin_fill(twin_pixmap_t *dst,
     twin_src_op op;
     twin_source_u src;
     twin_coord_t iy;
+    bool opaque;
 
     /* offset */
     left += dst->origin_x;
@@ -906,10 +999,15 @@ void twin_fill(twin_pixmap_t *dst,
         bottom = dst->clip.bottom;
     if (left >= right || top >= bottom)
         return;
+    _twin_composite_init();
     src.c = pixel;
+    opaque = (pixel >> 24) == 0xff;
+    if (opaque)
+        operator = TWIN_SOURCE;
     op = fill[operator][dst->format];
     for (iy = top; iy < bottom; iy++)
         (*op)(twin_pixmap_pointer(dst, left, iy), src, right - left);
+    _twin_update_opaque(dst, operator, opaque, left, top, right, bottom);
     twin_pixmap_damage(dst, left, top, right, bottom);
 }
 
@@ -943,10 +1041,13 @@ void twin_glass_fill(twin_pixmap_t *dst,
     if (left >= right || top >= bottom)
         return;
 
+    _twin_composite_init();
     src.c = pixel;
     op = fill[operator][dst->format];
 
     for (iy = 0; iy < dst->height; iy++)
         for (ix = 0; ix < dst->width; ix++)
             (*op)(twin_pixmap_pointer(dst, ix, iy), src, 1);
+    _twin_update_opaque(dst, operator, (pixel >> 24) == 0xff, 0, 0,
+                        dst->width, dst->height);
 }
@@ -4,90 +4,348 @@
  * All rights reserved.
  */
 
-#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <stdlib.h>
 #include <unistd.h>
 
-#ifdef USE_POLL
-#include <sys/poll.h>
+#if defined(__linux__)
+#define USE_EPOLL
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#else
+#include <poll.h>
 #endif
 
 #include "twin_private.h"
 
-static twin_queue_t *head;
+/*
+ * Registered files live in a table indexed from each file, so setting and
+ * clearing one costs O(1). On Linux the kernel keeps the interest set in
+ * an epoll instance and hands back only the files that are ready;
+ * elsewhere a pollfd array is kept alongside the table. Either way the
+ * arrays only grow, so a pass over the event loop allocates nothing.
+ *
+ * A descriptor may be set more than once, each time getting a file of its
+ * own. epoll holds a descriptor only once, so there its files are chained
+ * from a table indexed by descriptor, watched for the union of their ops,
+ * and each is handed the events it asked for.
+ *
+ * Procs may set and clear files while the ready ones are dispatched, so
+ * each pass works from a snapshot and cleared files are freed after it.
+ *
+ * Every wait also watches a wakeup channel, an eventfd or a pipe where
+ * eventfd is missing, so twin_wakeup() can end the wait from another
+ * thread or a signal handler.
+ */
+
+typedef struct {
+    twin_file_t *file;
+    twin_file_op_t op;
+} twin_file_ready_t;
+
+static twin_file_t **files;
+static int nfiles, files_size;
+
+static twin_file_ready_t *ready;
+static int ready_size;
+
+static bool dispatching;
+static twin_file_t *dead;
+
+/* read and write ends of the wakeup channel, the same eventfd on Linux */
+static int wakeup_fd[2] = {-1, -1};
+
+static void _twin_wakeup_drain(void)
+{
+    char buf[64];
+
+    while (read(wakeup_fd[0], buf, sizeof(buf)) > 0)
+        ;
+}
+
+void twin_wakeup(void)
+{
+    int fd = wakeup_fd[1];
+
+    if (fd >= 0) {
+        uint64_t one = 1;
+        /* a full pipe or counter already has a wakeup pending */
+        if (write(fd, &one, sizeof(one)) < 0)
+            return;
+    }
+}
+
+#ifdef USE_EPOLL
+static int epoll_fd = -1;
+static struct epoll_event *events;
+
+/* files epoll refuses, such as regular files, are always ready */
+static int nalways;
+
+/* the chain of files set on each descriptor */
+static twin_file_t **watched;
+static int watched_size;
+
+static bool _twin_file_open(void)
+{
+    struct epoll_event ev = {.events = EPOLLIN, .data.ptr = NULL};
+
+    if (epoll_fd >= 0)
+        return true;
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd < 0) {
+        log_error("Failed to create epoll instance");
+        return false;
+    }
+
+    wakeup_fd[0] = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (wakeup_fd[0] < 0 ||
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, wakeup_fd[0], &ev)) {
+        log_error("Failed to set up the wakeup eventfd");
+        return false;
+    }
+    wakeup_fd[1] = wakeup_fd[0];
+    return true;
+}
 
-static twin_order_t _twin_file_order(twin_queue_t *a, twin_queue_t *b)
+/* Tell epoll what the files chained on fd want, or add fd if it is new */
+static bool _twin_file_ctl(int op, int fd)
 {
-    twin_file_t *af = (twin_file_t *) a;
-    twin_file_t *bf = (twin_file_t *) b;
+    struct epoll_event ev = {.data.ptr = watched[fd]};
 
-    if (af->file < bf->file)
-        return TWIN_BEFORE;
-    if (af->file > bf->file)
-        return TWIN_AFTER;
-    return TWIN_AT;
+    for (twin_file_t *f = watched[fd]; f; f = f->same) {
+        if (f->ops & TWIN_READ)
+            ev.events |= EPOLLIN;
+        if (f->ops & TWIN_WRITE)
+            ev.events |= EPOLLOUT;
+    }
+    return !epoll_ctl(epoll_fd, op, fd, &ev);
 }
 
-int _twin_run_file(twin_time_t delay)
+static bool _twin_file_watch(twin_file_t *file)
 {
+    int fd = file->file;
     twin_file_t *first;
-    twin_file_t *file;
-    int n;
-    int i;
-#ifdef USE_POLL
-    struct pollfd *polls;
-#endif
 
-    first = (twin_file_t *) _twin_queue_set_order(&head);
-    if (first) {
-        for (file = first, n = 0; file;
-             file = (twin_file_t *) file->queue.order, n++)
-            ;
-#ifdef USE_POLL
-        polls = malloc(n * sizeof(struct pollfd));
-        if (!polls)
-            return 1;
-        for (file = first, i = 0; file;
-             file = (twin_file_t *) file->queue.order, i++) {
-            short events = 0;
-
-            if (file->ops & TWIN_READ)
-                events |= POLLIN;
-            if (file->ops & TWIN_WRITE)
-                events |= POLLOUT;
-            polls[i].fd = file->file;
-            polls[i].events = events;
+    if (!_twin_file_open() || fd < 0)
+        return false;
+    if (fd >= watched_size) {
+        int size = watched_size ? watched_size * 2 : 64;
+        twin_file_t **w;
+
+        while (size <= fd)
+            size *= 2;
+        w = realloc(watched, size * sizeof(*w));
+        if (!w)
+            return false;
+        memset(w + watched_size, 0, (size - watched_size) * sizeof(*w));
+        watched = w;
+        watched_size = size;
+    }
+
+    first = watched[fd];
+    file->same = first;
+    watched[fd] = file;
+    if (first && first->always) {
+        file->always = true;
+        nalways++;
+        return true;
+    }
+    if (_twin_file_ctl(first ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, fd))
+        return true;
+    watched[fd] = first;
+    if (first || errno != EPERM)
+        return false;
+    file->always = true;
+    nalways++;
+    watched[fd] = file;
+    return true;
+}
+
+static void _twin_file_unwatch(twin_file_t *file)
+{
+    twin_file_t **prev = &watched[file->file];
+
+    while (*prev != file)
+        prev = &(*prev)->same;
+    *prev = file->same;
+
+    if (file->always)
+        nalways--;
+    else if (watched[file->file])
+        _twin_file_ctl(EPOLL_CTL_MOD, file->file);
+    else
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, file->file, NULL);
+}
+
+static int _twin_file_wait(twin_time_t delay)
+{
+    int n = 0, r;
+
+    if (nalways) {
+        delay = 0;
+        for (int i = 0; i < nfiles; i++)
+            if (files[i]->always)
+                ready[n++] = (twin_file_ready_t){files[i], files[i]->ops};
+    }
+
+    r = epoll_wait(epoll_fd, events, nfiles + 1, delay);
+    for (int i = 0; i < r; i++) {
+        twin_file_op_t op = 0;
+
+        if (!events[i].data.ptr) {
+            _twin_wakeup_drain();
+            continue;
         }
-        int r = poll(polls, n, delay);
-        if (r > 0)
-#endif
-            for (file = first, i = 0; file;
-                 file = (twin_file_t *) file->queue.order, i++) {
-                twin_file_op_t op = 0;
-#ifdef USE_POLL
-                short events = polls[i].revents;
-                assert(polls[i].fd == file->file);
-                if (events & POLLIN)
-                    op |= TWIN_READ;
-                if (events & POLLOUT)
-                    op |= TWIN_WRITE;
-#endif
-                if (
-#ifdef USE_POLL
-                    op &&
+
+        if (events[i].events & EPOLLIN)
+            op |= TWIN_READ;
+        if (events[i].events & EPOLLOUT)
+            op |= TWIN_WRITE;
+        for (twin_file_t *file = events[i].data.ptr; file; file = file->same) {
+            /* let the proc find out about errors and hangups by itself */
+            if (events[i].events & (EPOLLERR | EPOLLHUP))
+                ready[n++] = (twin_file_ready_t){file, file->ops};
+            else if (op & file->ops)
+                ready[n++] = (twin_file_ready_t){file, op & file->ops};
+        }
+    }
+    return n;
+}
+#else
+/* one pollfd per file, followed by the read end of the wakeup pipe */
+static struct pollfd *polls;
+static int polls_size;
+
+static bool _twin_file_polls(int n)
+{
+    if (n > polls_size) {
+        int size = polls_size ? polls_size * 2 : 16;
+        struct pollfd *p;
+
+        while (size < n)
+            size *= 2;
+        p = realloc(polls, size * sizeof(*p));
+        if (!p)
+            return false;
+        polls = p;
+        polls_size = size;
+    }
+    return true;
+}
+
+static bool _twin_file_open(void)
+{
+    if (wakeup_fd[0] >= 0)
+        return true;
+    if (pipe(wakeup_fd)) {
+        log_error("Failed to set up the wakeup pipe");
+        return false;
+    }
+    for (int i = 0; i < 2; i++) {
+        fcntl(wakeup_fd[i], F_SETFD, FD_CLOEXEC);
+        fcntl(wakeup_fd[i], F_SETFL, O_NONBLOCK);
+    }
+    return true;
+}
+
+static bool _twin_file_watch(twin_file_t *file)
+{
+    short ev = 0;
+
+    if (file->ops & TWIN_READ)
+        ev |= POLLIN;
+    if (file->ops & TWIN_WRITE)
+        ev |= POLLOUT;
+
+    if (!_twin_file_open() || !_twin_file_polls(file->index + 2))
+        return false;
+    polls[file->index] = (struct pollfd){.fd = file->file, .events = ev};
+    return true;
+}
+
+static void _twin_file_unwatch(twin_file_t *file)
+{
+    polls[file->index] = polls[nfiles - 1];
+}
+
+static int _twin_file_wait(twin_time_t delay)
+{
+    int n = 0;
+
+    if (!_twin_file_polls(nfiles + 1))
+        return 0;
+    polls[nfiles] = (struct pollfd){.fd = wakeup_fd[0], .events = POLLIN};
+    if (poll(polls, nfiles + 1, delay) <= 0)
+        return 0;
+    if (polls[nfiles].revents)
+        _twin_wakeup_drain();
+    for (int i = 0; i < nfiles; i++) {
+        twin_file_op_t op = 0;
+
+        if (polls[i].revents & POLLIN)
+            op |= TWIN_READ;
+        if (polls[i].revents & POLLOUT)
+            op |= TWIN_WRITE;
+        if (polls[i].revents & (POLLERR | POLLHUP))
+            op |= files[i]->ops;
+        if (op)
+            ready[n++] = (twin_file_ready_t){files[i], op};
+    }
+    return n;
+}
 #endif
-                    !(*file->proc)(file->file, op, file->closure))
-                    _twin_queue_delete(&head, &file->queue);
-            }
-        _twin_queue_review_order(&first->queue);
-#ifdef USE_POLL
-        free(polls);
+
+/* Make room for n entries in each of the per-pass arrays */
+static bool _twin_file_reserve(int n)
+{
+    if (n <= ready_size)
+        return true;
+
+    twin_file_ready_t *r = realloc(ready, n * sizeof(*r));
+    if (!r)
+        return false;
+    ready = r;
+#ifdef USE_EPOLL
+    struct epoll_event *e = realloc(events, n * sizeof(*e));
+    if (!e)
+        return false;
+    events = e;
 #endif
-        return 1;
-    } else {
+    ready_size = n;
+    return true;
+}
+
+bool _twin_file_init(void)
+{
+    return _twin_file_open();
+}
+
+void _twin_run_file(twin_time_t delay)
+{
+    twin_file_t *file;
+    int n;
+
+    if (!_twin_file_open() || !_twin_file_reserve(nfiles + 1)) {
         if (delay > 0)
             usleep(delay * 1000);
-        return 0;
+        return;
+    }
+
+    n = _twin_file_wait(delay);
+    dispatching = true;
+    for (int i = 0; i < n; i++) {
+        file = ready[i].file;
+        if (!file->deleted && !(*file->proc)(file->file, ready[i].op,
+                                             file->closure))
+            twin_clear_file(file);
+    }
+    dispatching = false;
+
+    while ((file = dead)) {
+        dead = file->next;
+        free(file);
     }
 }
 
@@ -96,8 +354,19 @@ twin_file_t *twin_set_file(twin_file_proc_t file_proc,
                            twin_file_op_t ops,
                            void *closure)
 {
-    twin_file_t *file = malloc(sizeof(twin_file_t));
+    twin_file_t *file;
 
+    if (nfiles == files_size) {
+        int size = files_size ? files_size * 2 : 16;
+        twin_file_t **f = realloc(files, size * sizeof(*f));
+
+        if (!f)
+            return 0;
+        files = f;
+        files_size = size;
+    }
+
+    file = calloc(1, sizeof(twin_file_t));
     if (!file)
         return 0;
 
@@ -105,12 +374,27 @@ twin_file_t *twin_set_file(twin_file_proc_t file_proc,
     file->proc = file_proc;
     file->ops = ops;
     file->closure = closure;
+    file->index = nfiles;
 
-    _twin_queue_insert(&head, _twin_file_order, &file->queue);
+    if (!_twin_file_watch(file)) {
+        free(file);
+        return 0;
+    }
+    files[nfiles++] = file;
     return file;
 }
 
 void twin_clear_file(twin_file_t *file)
 {
-    _twin_queue_delete(&head, &file->queue);
+    _twin_file_unwatch(file);
+    files[file->index] = files[--nfiles];
+    files[file->index]->index = file->index;
+
+    /* a pass may still hold it in its snapshot */
+    if (dispatching) {
+        file->deleted = true;
+        file->next = dead;
+        dead = file;
+    } else
+        free(file);
 }
@@ -0,0 +1,212 @@
+/*
+ * Twin - A Tiny Window System
+ * Copyright (c) 2024 National Cheng Kung University, Taiwan
+ * All rights reserved.
+ */
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "font-file.h"
+#include "twin_private.h"
+
+/*
+ * Only the header, the charmap and the strike tables are read when a font
+ * is opened. Outlines and bitmaps stay in the file until a glyph touches
+ * them, and since fonts are read at random the kernel is told not to read
+ * ahead. Each glyph's outline is checked against n_outlines when it is
+ * drawn or measured, so opening never walks them.
+ */
+typedef struct _twin_font_file {
+    twin_font_t font;
+    void *map;
+    size_t size;
+    twin_font_strike_t strikes[];
+} twin_font_file_t;
+
+/* Whether n records of the given size at offset lie within the file */
+static bool _twin_font_file_fits(size_t size,
+                                 uint32_t offset,
+                                 uint32_t n,
+                                 size_t record)
+{
+    if (offset % 4 || offset > size)
+        return false;
+    return n <= (size - offset) / record;
+}
+
+static bool _twin_font_file_string(const uint8_t *map,
+                                   size_t size,
+                                   uint32_t offset)
+{
+    return offset < size && memchr(map + offset, '\0', size - offset);
+}
+
+static bool _twin_font_file_check(const uint8_t *map, size_t size)
+{
+    const twin_font_file_header_t *h = (const twin_font_file_header_t *) map;
+    const twin_charmap_t *charmap;
+
+    if (size < sizeof(*h) || h->magic != TWIN_FONT_FILE_MAGIC) {
+        log_error("Not a twin font");
+        return false;
+    }
+    if (h->version != TWIN_FONT_FILE_VERSION) {
+        log_error("Unsupported twin font version %u", h->version);
+        return false;
+    }
+    if (h->type != TWIN_FONT_TYPE_STROKE && h->type != TWIN_FONT_TYPE_TTF &&
+        h->type != TWIN_FONT_TYPE_BITMAP) {
+        log_error("Unknown font type %u", h->type);
+        return false;
+    }
+    if (!_twin_font_file_string(map, size, h->name) ||
+        !_twin_font_file_string(map, size, h->style) || !h->n_charmap ||
+        !_twin_font_file_fits(size, h->charmap, h->n_charmap,
+                              sizeof(twin_charmap_t)) ||
+        !h->n_outlines ||
+        !_twin_font_file_fits(size, h->outlines, h->n_outlines, 1) ||
+        !_twin_font_file_fits(size, h->strikes, h->n_strikes,
+                              sizeof(twin_font_file_strike_t))) {
+        log_error("Corrupt twin font");
+        return false;
+    }
+
+    /*
+     * Pages must be sorted for lookups to find them, and glyphs must start
+     * inside the outlines; font.c checks the rest of each glyph as it is
+     * drawn
+     */
+    charmap = (const twin_charmap_t *) (map + h->charmap);
+    for (uint32_t i = 0; i < h->n_charmap; i++) {
+        if (i && charmap[i].page <= charmap[i - 1].page) {
+            log_error("Unsorted twin font charmap");
+            return false;
+        }
+        for (int c = 0; c < UCS_PER_PAGE; c++)
+            if (charmap[i].offsets[c] >= h->n_outlines) {
+                log_error("Corrupt twin font charmap");
+                return false;
+            }
+    }
+
+    /*
+     * Bitmaps are looked up by binary search, and each one's rows, padded
+     * to 4 bytes, are read straight out of the strike's bits
+     */
+    for (uint32_t i = 0; i < h->n_strikes; i++) {
+        const twin_font_file_strike_t *s =
+            (const twin_font_file_strike_t *) (map + h->strikes) + i;
+        const twin_font_bitmap_t *bitmaps;
+
+        if (!_twin_font_file_fits(size, s->bitmaps, s->n_bitmaps,
+                                  sizeof(twin_font_bitmap_t)) ||
+            !_twin_font_file_fits(size, s->bits, s->n_bits, 1)) {
+            log_error("Corrupt twin font strike");
+            return false;
+        }
+        bitmaps = (const twin_font_bitmap_t *) (map + s->bitmaps);
+        for (uint32_t b = 0; b < s->n_bitmaps; b++) {
+            const twin_font_bitmap_t *bm = &bitmaps[b];
+            uint64_t stride = (bm->width + 3) & ~3;
+
+            if (b && bm->ucs4 <= bitmaps[b - 1].ucs4) {
+                log_error("Unsorted twin font strike %u", s->size);
+                return false;
+            }
+            if (bm->offset > s->n_bits ||
+                stride * bm->height > s->n_bits - bm->offset) {
+                log_error("Corrupt twin font bitmap 0x%x", bm->ucs4);
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+twin_font_t *twin_font_open(const char *path)
+{
+    const twin_font_file_header_t *h;
+    twin_font_file_t *file;
+    struct stat st;
+    void *map;
+    int fd;
+
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        log_error("Failed to open %s", path);
+        return NULL;
+    }
+    if (fstat(fd, &st) < 0 || st.st_size <= 0) {
+        log_error("Failed to stat %s", path);
+        close(fd);
+        return NULL;
+    }
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        log_error("Failed to map %s", path);
+        return NULL;
+    }
+    posix_madvise(map, st.st_size, POSIX_MADV_RANDOM);
+
+    if (!_twin_font_file_check(map, st.st_size))
+        goto bail;
+
+    h = map;
+    file = calloc(1, sizeof(twin_font_file_t) +
+                         h->n_strikes * sizeof(twin_font_strike_t));
+    if (!file)
+        goto bail;
+    file->map = map;
+    file->size = st.st_size;
+
+    for (uint32_t i = 0; i < h->n_strikes; i++) {
+        const twin_font_file_strike_t *s =
+            (const twin_font_file_strike_t *) ((uint8_t *) map + h->strikes) +
+            i;
+
+        file->strikes[i].size = s->size;
+        file->strikes[i].n_bitmaps = s->n_bitmaps;
+        file->strikes[i].bitmaps =
+            (const twin_font_bitmap_t *) ((uint8_t *) map + s->bitmaps);
+        file->strikes[i].bits = (const uint8_t *) map + s->bits;
+    }
+
+    file->font.type = h->type;
+    file->font.name = (const char *) map + h->name;
+    file->font.style = (const char *) map + h->style;
+    file->font.charmap =
+        (const twin_charmap_t *) ((const uint8_t *) map + h->charmap);
+    file->font.n_charmap = h->n_charmap;
+    file->font.outlines = (const signed char *) map + h->outlines;
+    file->font.n_outlines = h->n_outlines;
+    file->font.ascender = h->ascender;
+    file->font.descender = h->descender;
+    file->font.height = h->height;
+    if (h->n_strikes) {
+        file->font.strikes = file->strikes;
+        file->font.n_strikes = h->n_strikes;
+    }
+    return &file->font;
+
+bail:
+    munmap(map, st.st_size);
+    return NULL;
+}
+
+void twin_font_close(twin_font_t *font)
+{
+    twin_font_file_t *file = (twin_font_file_t *) font;
+
+    if (!font)
+        return;
+    if (g_twin_font == font)
+        g_twin_font = &twin_Default_Font_Roman;
+    _twin_glyph_cache_purge(font);
+    munmap(file->map, file->size);
+    free(file);
+}
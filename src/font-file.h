@@ -0,0 +1,45 @@
+/*
+ * Twin - A Tiny Window System
+ * Copyright (c) 2024 National Cheng Kung University, Taiwan
+ * All rights reserved.
+ */
+
+#ifndef _TWIN_FONT_FILE_H_
+#define _TWIN_FONT_FILE_H_
+
+#include <stdint.h>
+
+/*
+ * Binary font files, written by tools/ttf and mapped by twin_font_open().
+ * Values are in host byte order and every section starts on a 4 byte
+ * boundary, so the mapping is used in place: the charmap pages, outline
+ * bytes and strike bitmaps have the same layout as the twin_charmap_t,
+ * outlines and twin_font_bitmap_t arrays of a compiled-in font. Sections
+ * are found by byte offsets from the start of the file.
+ */
+#define TWIN_FONT_FILE_MAGIC 0x464e5754 /* "TWNF" */
+#define TWIN_FONT_FILE_VERSION 1
+
+typedef struct _twin_font_file_header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t type; /* TWIN_FONT_TYPE_* */
+    int8_t ascender, descender, height, pad;
+    uint32_t name, style; /* NUL terminated strings */
+    uint32_t n_charmap;   /* pages of a page number and UCS_PER_PAGE offsets */
+    uint32_t charmap;
+    uint32_t n_outlines; /* bytes */
+    uint32_t outlines;
+    uint32_t n_strikes;
+    uint32_t strikes;
+} twin_font_file_header_t;
+
+typedef struct _twin_font_file_strike {
+    uint32_t size;
+    uint32_t n_bitmaps; /* twin_font_bitmap_t records */
+    uint32_t bitmaps;
+    uint32_t n_bits; /* bytes */
+    uint32_t bits;
+} twin_font_file_strike_t;
+
+#endif /* _TWIN_FONT_FILE_H_ */
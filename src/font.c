@@ -175,9 +175,10 @@ static void _twin_text_compute_snap(twin_text_info_t *info,
         info->snap_y[s] = FY(snap[s], info);
 }
 
-static twin_path_t *_twin_text_compute_pen(const twin_text_info_t *info)
+static twin_path_t *_twin_text_compute_pen(const twin_path_t *path,
+                                           const twin_text_info_t *info)
 {
-    twin_path_t *pen = twin_path_create();
+    twin_path_t *pen = _twin_path_create_scratch(path);
 
     twin_path_set_matrix(pen, info->pen_matrix);
     twin_path_circle(pen, 0, 0, TWIN_FIXED_ONE);
@@ -207,37 +208,143 @@ static twin_fixed_t _twin_snap(twin_fixed_t v, const twin_fixed_t *snap, int n)
     return v;
 }
 
-static bool twin_find_ucs4_page(twin_font_t *font, uint32_t page)
+/*
+ * Charmap pages are sorted by page number, so a lookup is a binary search
+ * that leaves the font untouched and is safe from any thread
+ */
+static const twin_charmap_t *twin_find_ucs4_page(const twin_font_t *font,
+                                                 uint32_t page)
 {
-    if (font->cur_page && font->cur_page->page == page)
-        return true;
+    int lo = 0, hi = font->n_charmap;
 
-    for (int i = 0; i < font->n_charmap; i++)
-        if (font->charmap[i].page == page) {
-            font->cur_page = &font->charmap[i];
-            return true;
-        }
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
 
-    font->cur_page = &font->charmap[0];
-    return false;
+        if (font->charmap[mid].page < page)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    if (lo < font->n_charmap && font->charmap[lo].page == page)
+        return &font->charmap[lo];
+    return NULL;
 }
 
 bool twin_has_ucs4(twin_font_t *font, twin_ucs4_t ucs4)
 {
-    return twin_find_ucs4_page(font, twin_ucs_page(ucs4));
+    return twin_find_ucs4_page(font, twin_ucs_page(ucs4)) != NULL;
 }
 
 #define SNAPX(p) _snap(path, p, snap_x, nsnap_x)
 #define SNAPY(p) _snap(path, p, snap_y, nsnap_y)
 
+/*
+ * Whether the glyph at offset parses to its 'e' within the font's outline
+ * bytes, with no more snap points than text layout has room for
+ */
+static bool _twin_glyph_check(const twin_font_t *font, unsigned int offset)
+{
+    const signed char *b = font->outlines + offset;
+    unsigned int n = font->n_outlines - offset, i = 4;
+
+    if (font->type == TWIN_FONT_TYPE_STROKE) {
+        if (n < 6 || twin_glyph_n_snap_x(b) < 0 ||
+            twin_glyph_n_snap_x(b) > TWIN_GLYPH_MAX_SNAP_X ||
+            twin_glyph_n_snap_y(b) < 0 ||
+            twin_glyph_n_snap_y(b) > TWIN_GLYPH_MAX_SNAP_Y)
+            return false;
+        i = 6 + twin_glyph_n_snap_x(b) + twin_glyph_n_snap_y(b);
+    }
+
+    while (i < n) {
+        switch (b[i++]) {
+        case 'm':
+        case 'l':
+            i += 2;
+            break;
+        case 'c':
+            i += 6;
+            break;
+        case '2':
+            i += 4;
+            break;
+        case 'e':
+            return true;
+        default:
+            return false;
+        }
+    }
+    return false;
+}
+
 static const signed char *_twin_g_base(twin_font_t *font, twin_ucs4_t ucs4)
 {
-    int idx = twin_ucs_char_in_page(ucs4);
+    /* no extents, no snap points, no strokes */
+    static const signed char empty[] = {0, 0, 0, 0, 0, 0, 'e'};
+    const twin_charmap_t *page = twin_find_ucs4_page(font, twin_ucs_page(ucs4));
+    unsigned int offset;
+
+    /* code points the font lacks use its first glyph */
+    if (!page)
+        offset = font->charmap[0].offsets[0];
+    else
+        offset = page->offsets[twin_ucs_char_in_page(ucs4)];
+
+    /* mapped fonts are only checked up to where their glyphs start */
+    if (font->n_outlines && !_twin_glyph_check(font, offset)) {
+        log_error("Corrupt glyph for 0x%x in font %s", ucs4, font->name);
+        return empty;
+    }
+    return font->outlines + offset;
+}
+
+/*
+ * A strike replaces the outlines only where it matches them: hinted roman
+ * text at the strike's size, neither scaled nor rotated
+ */
+const twin_font_strike_t *_twin_font_strike(const twin_font_t *font,
+                                            const twin_path_t *path)
+{
+    const twin_matrix_t *m = &path->state.matrix;
+
+    if (font->type != TWIN_FONT_TYPE_BITMAP ||
+        path->state.font_style != TwinStyleRoman ||
+        m->m[0][0] != TWIN_FIXED_ONE || m->m[1][1] != TWIN_FIXED_ONE ||
+        m->m[0][1] || m->m[1][0])
+        return NULL;
+
+    for (int i = 0; i < font->n_strikes; i++)
+        if (twin_int_to_fixed(font->strikes[i].size) == path->state.font_size)
+            return &font->strikes[i];
+    return NULL;
+}
+
+const twin_font_bitmap_t *_twin_font_strike_bitmap(
+    const twin_font_strike_t *strike,
+    twin_ucs4_t ucs4)
+{
+    int lo = 0, hi = strike->n_bitmaps;
+
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+
+        if (strike->bitmaps[mid].ucs4 < ucs4)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    if (lo < strike->n_bitmaps && strike->bitmaps[lo].ucs4 == ucs4)
+        return &strike->bitmaps[lo];
+    return NULL;
+}
 
-    if (!twin_find_ucs4_page(font, twin_ucs_page(ucs4)))
-        idx = 0;
+static const twin_font_bitmap_t *_twin_font_bitmap(const twin_font_t *font,
+                                                   const twin_path_t *path,
+                                                   twin_ucs4_t ucs4)
+{
+    const twin_font_strike_t *strike = _twin_font_strike(font, path);
 
-    return font->outlines + font->cur_page->offsets[idx];
+    return strike ? _twin_font_strike_bitmap(strike, ucs4) : NULL;
 }
 
 static twin_fixed_t _twin_glyph_width(twin_text_info_t *info,
@@ -260,8 +367,9 @@ void twin_text_metrics_ucs4(twin_path_t *path,
                             twin_ucs4_t ucs4,
                             twin_text_metrics_t *m)
 {
-    twin_font_t *font = g_twin_font;
+    twin_font_t *font = _twin_path_font(path);
     const signed char *b = _twin_g_base(font, ucs4);
+    const twin_font_bitmap_t *bitmap;
     twin_text_info_t info;
     twin_fixed_t left, right, ascent, descent;
     twin_fixed_t font_spacing;
@@ -307,6 +415,17 @@ void twin_text_metrics_ucs4(twin_path_t *path,
     m->width = m->right_side_bearing + margin_x;
     m->font_ascent = font_ascent + margin_y;
     m->font_descent = font_descent + margin_y;
+
+    /* a matching strike is what gets painted, so measure that instead */
+    bitmap = _twin_font_bitmap(font, path, ucs4);
+    if (bitmap) {
+        m->left_side_bearing = twin_int_to_fixed(bitmap->left);
+        m->right_side_bearing =
+            twin_int_to_fixed(bitmap->left + bitmap->width);
+        m->ascent = twin_int_to_fixed(-bitmap->top);
+        m->descent = twin_int_to_fixed(bitmap->top + bitmap->height);
+        m->width = bitmap->advance;
+    }
 }
 
 static const signed char *twin_glyph_draw(const twin_font_t *font,
@@ -319,7 +438,7 @@ static const signed char *twin_glyph_draw(const twin_font_t *font,
 
 void twin_path_ucs4(twin_path_t *path, twin_ucs4_t ucs4)
 {
-    twin_font_t *font = g_twin_font;
+    twin_font_t *font = _twin_path_font(path);
     const signed char *b = _twin_g_base(font, ucs4);
     const signed char *g = twin_glyph_draw(font, b);
     twin_spoint_t origin;
@@ -327,6 +446,7 @@ void twin_path_ucs4(twin_path_t *path, twin_ucs4_t ucs4)
     twin_path_t *stroke;
     twin_path_t *pen = NULL;
     twin_fixed_t width;
+    const twin_font_bitmap_t *bitmap = _twin_font_bitmap(font, path, ucs4);
     twin_text_info_t info;
 
     _twin_text_compute_info(path, font, &info);
@@ -335,11 +455,11 @@ void twin_path_ucs4(twin_path_t *path, twin_ucs4_t ucs4)
 
     origin = _twin_path_current_spoint(path);
 
-    stroke = twin_path_create();
+    stroke = _twin_path_create_scratch(path);
     twin_path_set_matrix(stroke, info.matrix);
 
     if (font->type == TWIN_FONT_TYPE_STROKE)
-        pen = _twin_text_compute_pen(&info);
+        pen = _twin_text_compute_pen(path, &info);
 
     x1 = y1 = 0;
     for (;;) {
@@ -402,11 +522,15 @@ void twin_path_ucs4(twin_path_t *path, twin_ucs4_t ucs4)
     if (font->type == TWIN_FONT_TYPE_STROKE) {
         twin_path_convolve(path, stroke, pen);
         twin_path_destroy(pen);
-    } else
+    } else {
+        /* drop the lone pen position so it doesn't join the first contour */
+        _twin_path_sfinish(path);
         twin_path_append(path, stroke);
+    }
     twin_path_destroy(stroke);
 
-    width = _twin_glyph_width(&info, b);
+    /* advance as painting from the strike does */
+    width = bitmap ? bitmap->advance : _twin_glyph_width(&info, b);
 
     _twin_path_smove(path, origin.x + _twin_matrix_dx(&info.matrix, width, 0),
                      origin.y + _twin_matrix_dy(&info.matrix, width, 0));
@@ -420,7 +544,7 @@ twin_fixed_t twin_width_ucs4(twin_path_t *path, twin_ucs4_t ucs4)
     return metrics.width;
 }
 
-static int _twin_utf8_to_ucs4(const char *src_orig, twin_ucs4_t *dst)
+int _twin_utf8_to_ucs4(const char *src_orig, twin_ucs4_t *dst)
 {
     const char *src = src_orig;
     char s;
@@ -494,6 +618,36 @@ twin_fixed_t twin_width_utf8(twin_path_t *path, const char *string)
     return w;
 }
 
+/*
+ * Fold the metrics of a glyph drawn at pen position w into those of the
+ * text before it, returning the pen position after the glyph
+ */
+twin_fixed_t _twin_text_metrics_add(twin_text_metrics_t *m,
+                                    twin_text_metrics_t *c,
+                                    twin_fixed_t w,
+                                    bool first)
+{
+    if (first) {
+        *m = *c;
+        return c->width;
+    }
+    c->left_side_bearing += w;
+    c->right_side_bearing += w;
+    c->width += w;
+
+    if (c->left_side_bearing < m->left_side_bearing)
+        m->left_side_bearing = c->left_side_bearing;
+    if (c->right_side_bearing > m->right_side_bearing)
+        m->right_side_bearing = c->right_side_bearing;
+    if (c->width > m->width)
+        m->width = c->width;
+    if (c->ascent > m->ascent)
+        m->ascent = c->ascent;
+    if (c->descent > m->descent)
+        m->descent = c->descent;
+    return c->width;
+}
+
 void twin_text_metrics_utf8(twin_path_t *path,
                             const char *string,
                             twin_text_metrics_t *m)
@@ -506,26 +660,8 @@ void twin_text_metrics_utf8(twin_path_t *path,
 
     while ((len = _twin_utf8_to_ucs4(string, &ucs4)) > 0) {
         twin_text_metrics_ucs4(path, ucs4, &c);
-        if (first) {
-            *m = c;
-            first = false;
-        } else {
-            c.left_side_bearing += w;
-            c.right_side_bearing += w;
-            c.width += w;
-
-            if (c.left_side_bearing < m->left_side_bearing)
-                m->left_side_bearing = c.left_side_bearing;
-            if (c.right_side_bearing > m->right_side_bearing)
-                m->right_side_bearing = c.right_side_bearing;
-            if (c.width > m->width)
-                m->width = c.width;
-            if (c.ascent > m->ascent)
-                m->ascent = c.ascent;
-            if (c.descent > m->descent)
-                m->descent = c.descent;
-        }
-        w = c.width;
+        w = _twin_text_metrics_add(m, &c, w, first);
+        first = false;
         string += len;
     }
 }
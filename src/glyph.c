@@ -0,0 +1,493 @@
+/*
+ * Twin - A Tiny Window System
+ * Copyright (c) 2024 National Cheng Kung University, Taiwan
+ * All rights reserved.
+ */
+
+#include <stdlib.h>
+
+#include "twin_private.h"
+
+/*
+ * Rasterized glyphs are kept as A8 masks, so drawing the same text again
+ * only composites them. A mask depends on everything that shapes the
+ * outline and its fill: the font, code point, size, style, antialiasing
+ * and the scale of the path matrix, plus where the pen sits within its
+ * pixel. Hinted stroke glyphs are snapped to whole pixels anyway; other
+ * glyphs have the pen rounded to a quarter pixel. Once the masks outgrow
+ * CONFIG_GLYPH_CACHE_SIZE KiB the least recently drawn ones are dropped.
+ * Glyphs found in a font strike are not rasterized at all; their masks
+ * point at the strike's bits.
+ */
+#define GLYPH_SUBPIXEL_STEP (TWIN_SFIXED_ONE / 4)
+#define GLYPH_BUCKETS 512
+
+typedef struct _twin_glyph_key {
+    const twin_font_t *font;
+    twin_ucs4_t ucs4;
+    twin_fixed_t font_size;
+    twin_fixed_t scale_x, scale_y;
+    twin_style_t style;
+    twin_antialias_t antialias;
+    twin_sfixed_t sub_x, sub_y;
+} twin_glyph_key_t;
+
+typedef struct _twin_glyph {
+    struct _twin_glyph *next;  /* hash chain */
+    struct _twin_glyph *older; /* LRU list */
+    struct _twin_glyph *newer;
+    twin_glyph_key_t key;
+    twin_pixmap_t *mask;    /* NULL when the glyph covers nothing */
+    twin_coord_t left, top; /* mask position from the pen's pixel */
+    twin_spoint_t advance;
+    size_t bytes;
+} twin_glyph_t;
+
+static twin_glyph_t *buckets[GLYPH_BUCKETS];
+static twin_glyph_t *oldest, *newest;
+static size_t cache_bytes;
+
+static unsigned _twin_glyph_hash(const twin_glyph_key_t *key)
+{
+    uint32_t h = 2166136261u;
+
+    h = (h ^ (uint32_t) (uintptr_t) key->font) * 16777619u;
+    h = (h ^ key->ucs4) * 16777619u;
+    h = (h ^ (uint32_t) key->font_size) * 16777619u;
+    h = (h ^ (uint32_t) key->scale_x) * 16777619u;
+    h = (h ^ (uint32_t) key->scale_y) * 16777619u;
+    h = (h ^ key->style) * 16777619u;
+    h = (h ^ key->antialias) * 16777619u;
+    h = (h ^ (uint32_t) (key->sub_x << 8 | key->sub_y)) * 16777619u;
+    return h % GLYPH_BUCKETS;
+}
+
+static bool _twin_glyph_key_equal(const twin_glyph_key_t *a,
+                                  const twin_glyph_key_t *b)
+{
+    return a->font == b->font && a->ucs4 == b->ucs4 &&
+           a->font_size == b->font_size && a->scale_x == b->scale_x &&
+           a->scale_y == b->scale_y && a->style == b->style &&
+           a->antialias == b->antialias && a->sub_x == b->sub_x &&
+           a->sub_y == b->sub_y;
+}
+
+static void _twin_glyph_unlink(twin_glyph_t *glyph)
+{
+    if (glyph->older)
+        glyph->older->newer = glyph->newer;
+    else
+        oldest = glyph->newer;
+    if (glyph->newer)
+        glyph->newer->older = glyph->older;
+    else
+        newest = glyph->older;
+}
+
+static void _twin_glyph_link(twin_glyph_t *glyph)
+{
+    glyph->older = newest;
+    glyph->newer = NULL;
+    if (newest)
+        newest->newer = glyph;
+    else
+        oldest = glyph;
+    newest = glyph;
+}
+
+static void _twin_glyph_evict(twin_glyph_t *glyph)
+{
+    twin_glyph_t **prev = &buckets[_twin_glyph_hash(&glyph->key)];
+
+    while (*prev != glyph)
+        prev = &(*prev)->next;
+    *prev = glyph->next;
+    _twin_glyph_unlink(glyph);
+    cache_bytes -= glyph->bytes;
+    if (glyph->mask)
+        twin_pixmap_destroy(glyph->mask);
+    free(glyph);
+}
+
+void _twin_glyph_cache_purge(const twin_font_t *font)
+{
+    twin_glyph_t *glyph, *newer;
+
+    for (glyph = oldest; glyph; glyph = newer) {
+        newer = glyph->newer;
+        if (glyph->key.font == font)
+            _twin_glyph_evict(glyph);
+    }
+}
+
+/* Use a strike bitmap in place as the mask; nothing is copied */
+static twin_glyph_t *_twin_glyph_strike(const twin_glyph_key_t *key,
+                                        const twin_font_strike_t *strike,
+                                        const twin_font_bitmap_t *bitmap)
+{
+    twin_glyph_t *glyph = calloc(1, sizeof(twin_glyph_t));
+
+    if (!glyph)
+        return NULL;
+    if (bitmap->width && bitmap->height) {
+        twin_pointer_t bits = {.b = (uint8_t *) strike->bits + bitmap->offset};
+
+        glyph->mask =
+            twin_pixmap_create_const(TWIN_A8, bitmap->width, bitmap->height,
+                                     (bitmap->width + 3) & ~3, bits);
+        if (!glyph->mask) {
+            free(glyph);
+            return NULL;
+        }
+        glyph->bytes = sizeof(twin_pixmap_t);
+    }
+    glyph->left = bitmap->left;
+    glyph->top = bitmap->top;
+    glyph->advance.x = twin_fixed_to_sfixed(bitmap->advance);
+    glyph->bytes += sizeof(twin_glyph_t);
+    glyph->key = *key;
+    return glyph;
+}
+
+/* Outline the glyph with the pen at its subpixel offset and fill it */
+static twin_glyph_t *_twin_glyph_render(const twin_glyph_key_t *key,
+                                        twin_path_t *path,
+                                        const twin_font_strike_t *strike)
+{
+    const twin_font_bitmap_t *bitmap =
+        strike ? _twin_font_strike_bitmap(strike, key->ucs4) : NULL;
+    twin_glyph_t *glyph;
+    twin_path_t *outline;
+    twin_spoint_t end;
+    twin_rect_t bounds;
+
+    if (bitmap)
+        return _twin_glyph_strike(key, strike, bitmap);
+
+    glyph = calloc(1, sizeof(twin_glyph_t));
+    outline = twin_path_create();
+    if (!glyph || !outline)
+        goto bail;
+
+    /* the key holds what of the state shapes the glyph, font included */
+    outline->state = path->state;
+    _twin_path_smove(outline, key->sub_x, key->sub_y);
+    twin_path_ucs4(outline, key->ucs4);
+
+    end = _twin_path_current_spoint(outline);
+    glyph->advance.x = end.x - key->sub_x;
+    glyph->advance.y = end.y - key->sub_y;
+
+    /* coverage spills a pixel past the outline's rounded bounds */
+    twin_path_bounds(outline, &bounds);
+    if (bounds.left < bounds.right && bounds.top < bounds.bottom) {
+        bounds.left--;
+        bounds.top--;
+        bounds.right++;
+        bounds.bottom++;
+        glyph->mask = twin_pixmap_create(TWIN_A8, bounds.right - bounds.left,
+                                         bounds.bottom - bounds.top);
+        if (!glyph->mask)
+            goto bail;
+        twin_path_set_antialias(outline, key->antialias);
+        twin_fill_path(glyph->mask, outline, -bounds.left, -bounds.top);
+        glyph->bytes = (size_t) glyph->mask->stride * glyph->mask->height;
+    }
+    glyph->left = bounds.left;
+    glyph->top = bounds.top;
+    glyph->bytes += sizeof(twin_glyph_t);
+    glyph->key = *key;
+    twin_path_destroy(outline);
+    return glyph;
+
+bail:
+    if (outline)
+        twin_path_destroy(outline);
+    free(glyph);
+    return NULL;
+}
+
+static twin_glyph_t *_twin_glyph_lookup(const twin_glyph_key_t *key,
+                                        twin_path_t *path,
+                                        const twin_font_strike_t *strike)
+{
+    unsigned h = _twin_glyph_hash(key);
+    twin_glyph_t *glyph;
+
+    for (glyph = buckets[h]; glyph; glyph = glyph->next) {
+        if (_twin_glyph_key_equal(&glyph->key, key)) {
+            _twin_glyph_unlink(glyph);
+            _twin_glyph_link(glyph);
+            return glyph;
+        }
+    }
+
+    glyph = _twin_glyph_render(key, path, strike);
+    if (!glyph)
+        return NULL;
+    glyph->next = buckets[h];
+    buckets[h] = glyph;
+    _twin_glyph_link(glyph);
+    cache_bytes += glyph->bytes;
+
+    while (cache_bytes > (size_t) CONFIG_GLYPH_CACHE_SIZE * 1024 &&
+           oldest != glyph)
+        _twin_glyph_evict(oldest);
+    return glyph;
+}
+
+/* Composite a strike bitmap straight from the font, pen at (x, y) */
+static void _twin_paint_strike(twin_pixmap_t *dst,
+                               twin_operand_t *src,
+                               const twin_font_strike_t *strike,
+                               const twin_font_bitmap_t *bitmap,
+                               twin_sfixed_t x,
+                               twin_sfixed_t y)
+{
+    twin_pointer_t bits = {.b = (uint8_t *) strike->bits + bitmap->offset};
+    twin_pixmap_t mask;
+    twin_operand_t msk = {.source_kind = TWIN_PIXMAP, .u.pixmap = &mask};
+
+    if (!bitmap->width || !bitmap->height)
+        return;
+    _twin_pixmap_init_const(&mask, TWIN_A8, bitmap->width, bitmap->height,
+                            (bitmap->width + 3) & ~3, bits);
+    x = twin_sfixed_floor(x + TWIN_SFIXED_HALF);
+    y = twin_sfixed_floor(y + TWIN_SFIXED_HALF);
+    twin_composite(dst, twin_sfixed_trunc(x) + bitmap->left,
+                   twin_sfixed_trunc(y) + bitmap->top, src, 0, 0, &msk, 0, 0,
+                   TWIN_OVER, bitmap->width, bitmap->height);
+}
+
+/*
+ * Draw through a scratch path, for text the cache cannot hold. Glyphs a
+ * strike has are still composited from its bits, so text is drawn the
+ * way it is measured whether or not the cache is in use.
+ */
+static void _twin_paint_ucs4_path(twin_pixmap_t *dst,
+                                  twin_argb32_t argb,
+                                  twin_path_t *path,
+                                  const twin_ucs4_t *ucs4,
+                                  int n)
+{
+    const twin_font_strike_t *strike =
+        _twin_font_strike(_twin_path_font(path), path);
+    twin_operand_t src = {.source_kind = TWIN_SOLID, .u.argb = argb};
+    twin_spoint_t here = _twin_path_current_spoint(path);
+    twin_path_t *text = NULL;
+
+    for (int i = 0; i < n; i++) {
+        const twin_font_bitmap_t *bitmap =
+            strike ? _twin_font_strike_bitmap(strike, ucs4[i]) : NULL;
+
+        if (bitmap) {
+            if (text) {
+                twin_paint_path(dst, argb, text);
+                twin_path_destroy(text);
+                text = NULL;
+            }
+            _twin_paint_strike(dst, &src, strike, bitmap, here.x, here.y);
+            here.x += twin_fixed_to_sfixed(bitmap->advance);
+            continue;
+        }
+        if (!text) {
+            text = _twin_path_create_scratch(path);
+            if (!text)
+                break;
+            text->state = path->state;
+            _twin_path_smove(text, here.x, here.y);
+        }
+        twin_path_ucs4(text, ucs4[i]);
+        here = _twin_path_current_spoint(text);
+    }
+    if (text) {
+        twin_paint_path(dst, argb, text);
+        twin_path_destroy(text);
+    }
+    _twin_path_smove(path, here.x, here.y);
+}
+
+static void _twin_paint_ucs4(twin_pixmap_t *dst,
+                             twin_argb32_t argb,
+                             twin_path_t *path,
+                             const twin_ucs4_t *ucs4,
+                             int n)
+{
+    const twin_matrix_t *m = &path->state.matrix;
+    twin_operand_t src = {.source_kind = TWIN_SOLID, .u.argb = argb};
+    twin_spoint_t pen = _twin_path_current_spoint(path);
+    const twin_font_strike_t *strike;
+    twin_glyph_key_t key;
+    bool snap;
+
+    /* only text that is not rotated or sheared shares glyph masks */
+    if (!CONFIG_GLYPH_CACHE_SIZE || m->m[0][1] || m->m[1][0]) {
+        _twin_paint_ucs4_path(dst, argb, path, ucs4, n);
+        return;
+    }
+
+    key.font = _twin_path_font(path);
+    key.font_size = path->state.font_size;
+    key.scale_x = m->m[0][0];
+    key.scale_y = m->m[1][1];
+    key.style = path->state.font_style;
+    key.antialias = path->state.antialias;
+    strike = _twin_font_strike(key.font, path);
+    snap = strike || (key.font->type == TWIN_FONT_TYPE_STROKE &&
+                      !(key.style & TwinStyleUnhinted));
+
+    for (int i = 0; i < n; i++) {
+        twin_sfixed_t x = pen.x, y = pen.y;
+        twin_glyph_t *glyph;
+
+        if (snap) {
+            /* as twin_path_ucs4 does; strike bitmaps sit on whole pixels */
+            x = twin_sfixed_floor(x + TWIN_SFIXED_HALF);
+            y = twin_sfixed_floor(y + TWIN_SFIXED_HALF);
+        } else {
+            x = (x + GLYPH_SUBPIXEL_STEP / 2) & ~(GLYPH_SUBPIXEL_STEP - 1);
+            y = (y + GLYPH_SUBPIXEL_STEP / 2) & ~(GLYPH_SUBPIXEL_STEP - 1);
+        }
+        key.ucs4 = ucs4[i];
+        key.sub_x = x - twin_sfixed_floor(x);
+        key.sub_y = y - twin_sfixed_floor(y);
+
+        glyph = _twin_glyph_lookup(&key, path, strike);
+        if (!glyph) {
+            _twin_path_smove(path, pen.x, pen.y);
+            _twin_paint_ucs4_path(dst, argb, path, ucs4 + i, n - i);
+            return;
+        }
+        if (glyph->mask) {
+            twin_operand_t msk = {
+                .source_kind = TWIN_PIXMAP,
+                .u.pixmap = glyph->mask,
+            };
+            twin_composite(dst, twin_sfixed_trunc(x) + glyph->left,
+                           twin_sfixed_trunc(y) + glyph->top, &src, 0, 0,
+                           &msk, 0, 0, TWIN_OVER, glyph->mask->width,
+                           glyph->mask->height);
+        }
+        pen.x += glyph->advance.x;
+        pen.y += glyph->advance.y;
+    }
+    _twin_path_smove(path, pen.x, pen.y);
+}
+
+void twin_paint_utf8(twin_pixmap_t *dst,
+                     twin_argb32_t argb,
+                     twin_path_t *path,
+                     const char *string)
+{
+    twin_ucs4_t ucs4[64];
+    int n, len;
+
+    /* decode a run at a time; the pen carries over in the path */
+    do {
+        for (n = 0; n < 64; n++) {
+            len = _twin_utf8_to_ucs4(string, &ucs4[n]);
+            if (len <= 0)
+                break;
+            string += len;
+        }
+        _twin_paint_ucs4(dst, argb, path, ucs4, n);
+    } while (n == 64);
+}
+
+/*
+ * A layout keeps a string decoded along with its metrics for the font,
+ * size, style and matrix it was made with, so widgets that measure and
+ * paint the same text over and over do the per-glyph work once.
+ */
+struct _twin_text_layout {
+    char *string;
+    const twin_font_t *font;
+    twin_fixed_t font_size;
+    twin_style_t font_style;
+    twin_fixed_t m[2][2]; /* translation does not change metrics */
+    twin_text_metrics_t metrics;
+    int n;
+    twin_ucs4_t ucs4[];
+};
+
+static bool _twin_text_layout_matches(const twin_text_layout_t *layout,
+                                      twin_path_t *path,
+                                      const char *string)
+{
+    const twin_matrix_t *m = &path->state.matrix;
+
+    return layout->font == _twin_path_font(path) &&
+           layout->font_size == path->state.font_size &&
+           layout->font_style == path->state.font_style &&
+           layout->m[0][0] == m->m[0][0] && layout->m[0][1] == m->m[0][1] &&
+           layout->m[1][0] == m->m[1][0] && layout->m[1][1] == m->m[1][1] &&
+           !strcmp(layout->string, string);
+}
+
+twin_text_layout_t *twin_text_layout_create(twin_path_t *path,
+                                            const char *string)
+{
+    twin_text_layout_t *layout;
+    size_t size = strlen(string) + 1;
+    twin_fixed_t w = 0;
+    twin_ucs4_t ucs4;
+    int n = 0, len;
+
+    for (const char *s = string; (len = _twin_utf8_to_ucs4(s, &ucs4)) > 0;
+         s += len)
+        n++;
+
+    layout = malloc(sizeof(twin_text_layout_t) + n * sizeof(twin_ucs4_t) +
+                    size);
+    if (!layout)
+        return NULL;
+    layout->string = (char *) (layout->ucs4 + n);
+    memcpy(layout->string, string, size);
+    layout->font = _twin_path_font(path);
+    layout->font_size = path->state.font_size;
+    layout->font_style = path->state.font_style;
+    layout->m[0][0] = path->state.matrix.m[0][0];
+    layout->m[0][1] = path->state.matrix.m[0][1];
+    layout->m[1][0] = path->state.matrix.m[1][0];
+    layout->m[1][1] = path->state.matrix.m[1][1];
+    layout->n = n;
+
+    memset(&layout->metrics, 0, sizeof(layout->metrics));
+    for (int i = 0; i < n; i++) {
+        twin_text_metrics_t c;
+
+        string += _twin_utf8_to_ucs4(string, &layout->ucs4[i]);
+        twin_text_metrics_ucs4(path, layout->ucs4[i], &c);
+        w = _twin_text_metrics_add(&layout->metrics, &c, w, i == 0);
+    }
+    return layout;
+}
+
+twin_text_layout_t *twin_text_layout_update(twin_text_layout_t *layout,
+                                            twin_path_t *path,
+                                            const char *string)
+{
+    if (layout && _twin_text_layout_matches(layout, path, string))
+        return layout;
+    twin_text_layout_destroy(layout);
+    return twin_text_layout_create(path, string);
+}
+
+void twin_text_layout_destroy(twin_text_layout_t *layout)
+{
+    free(layout);
+}
+
+void twin_text_layout_metrics(const twin_text_layout_t *layout,
+                              twin_text_metrics_t *m)
+{
+    *m = layout->metrics;
+}
+
+void twin_paint_text_layout(twin_pixmap_t *dst,
+                            twin_argb32_t argb,
+                            twin_path_t *path,
+                            const twin_text_layout_t *layout)
+{
+    _twin_paint_ucs4(dst, argb, path, layout->ucs4, layout->n);
+}
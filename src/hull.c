@@ -39,7 +39,10 @@ static twin_hull_t *_twin_hull_create(const twin_path_t *path, int *nhull)
         if (p[i].y < p[e].y || (p[i].y == p[e].y && p[i].x < p[e].x))
             e = i;
 
-    hull = malloc(n * sizeof(twin_hull_t));
+    if (path->arena)
+        hull = twin_arena_alloc(path->arena, n * sizeof(twin_hull_t));
+    else
+        hull = malloc(n * sizeof(twin_hull_t));
     if (!hull)
         return NULL;
     *nhull = n;
@@ -180,9 +183,11 @@ static void _twin_hull_eliminate_concave(twin_hull_t *hull, int num_hull)
 /*
  * Convert the hull structure back to a simple path
  */
-static twin_path_t *_twin_hull_to_path(const twin_hull_t *hull, int num_hull)
+static twin_path_t *_twin_hull_to_path(const twin_path_t *source,
+                                       const twin_hull_t *hull,
+                                       int num_hull)
 {
-    twin_path_t *path = twin_path_create();
+    twin_path_t *path = _twin_path_create_scratch(source);
 
     for (int i = 0; i < num_hull; i++) {
         if (hull[i].discard)
@@ -212,9 +217,10 @@ twin_path_t *twin_path_convex_hull(twin_path_t *path)
 
     _twin_hull_eliminate_concave(hull, num_hull);
 
-    convex_path = _twin_hull_to_path(hull, num_hull);
+    convex_path = _twin_hull_to_path(path, hull, num_hull);
 
-    free(hull);
+    if (!path->arena)
+        free(hull);
 
     return convex_path;
 }
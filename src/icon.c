@@ -116,10 +116,15 @@ void twin_icon_draw(twin_pixmap_t *pixmap,
                     twin_icon_t icon,
                     twin_matrix_t matrix)
 {
-    twin_path_t *path = twin_path_create();
+    twin_path_t *path = NULL;
     const signed char *g = _twin_itable + _twin_icons[icon];
     twin_fixed_t stroke_width = twin_double_to_fixed(ICON_THIN);
 
+    /* shown pixmaps draw out of their screen's scratch */
+    if (pixmap->screen)
+        path = twin_path_create_arena(&pixmap->screen->arena);
+    if (!path)
+        path = twin_path_create();
     twin_path_set_matrix(path, matrix);
     for (;;) {
         switch (*g++) {
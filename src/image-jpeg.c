@@ -116,6 +116,10 @@ twin_pixmap_t *_twin_jpeg_to_pixmap(const char *filepath, twin_format_t fmt)
         }
     }
 
+    /* three component images were given an opaque alpha channel */
+    if (fmt == TWIN_ARGB32 && cinfo.output_components == 3)
+        twin_pixmap_set_opaque(pix, 0, 0, width, height);
+
     /* clean up */
     (void) jpeg_finish_decompress(&cinfo);
     jpeg_destroy_decompress(&cinfo);
@@ -84,6 +84,8 @@ twin_pixmap_t *_twin_png_to_pixmap(const char *filepath, twin_format_t fmt)
     png_uint_32 width, height;
     png_get_IHDR(png, info, &width, &height, &depth, &ctype, &interlace, NULL,
                  NULL);
+    bool opaque = !(ctype & PNG_COLOR_MASK_ALPHA) &&
+                  !png_get_valid(png, info, PNG_INFO_tRNS);
 
     if (depth == 16)
         png_set_strip_16(png);
@@ -138,7 +140,10 @@ twin_pixmap_t *_twin_png_to_pixmap(const char *filepath, twin_format_t fmt)
 #if defined(__APPLE__)
         _convertBGRtoARGB(pix->p.b, width, height);
 #endif
-        twin_premultiply_alpha(pix);
+        if (opaque)
+            twin_pixmap_set_opaque(pix, 0, 0, width, height);
+        else
+            twin_premultiply_alpha(pix);
     }
 
 bail_free:
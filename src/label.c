@@ -8,18 +8,30 @@
 
 #include "twin_private.h"
 
+/* Set up path for the label's text, whose layout is kept between uses */
+static const twin_text_layout_t *_twin_label_layout(twin_label_t *label,
+                                                    twin_path_t *path)
+{
+    twin_path_set_font_size(path, label->font_size);
+    twin_path_set_font_style(path, label->font_style);
+    label->layout = twin_text_layout_update(label->layout, path, label->label);
+    return label->layout;
+}
+
 static void _twin_label_query_geometry(twin_label_t *label)
 {
     twin_path_t *path = twin_path_create();
+    const twin_text_layout_t *layout;
     twin_text_metrics_t m;
 
     label->widget.preferred.width = twin_fixed_to_int(label->font_size) * 2;
     label->widget.preferred.height = twin_fixed_to_int(label->font_size) * 2;
     if (path) {
-        twin_path_set_font_size(path, label->font_size);
-        twin_path_set_font_style(path, label->font_style);
-        twin_text_metrics_utf8(path, label->label, &m);
-        label->widget.preferred.width += twin_fixed_to_int(m.width);
+        layout = _twin_label_layout(label, path);
+        if (layout) {
+            twin_text_layout_metrics(layout, &m);
+            label->widget.preferred.width += twin_fixed_to_int(m.width);
+        }
         twin_path_destroy(path);
     }
 }
@@ -27,18 +39,17 @@ static void _twin_label_query_geometry(twin_label_t *label)
 static void _twin_label_paint(twin_label_t *label)
 {
     twin_path_t *path = twin_path_create();
+    const twin_text_layout_t *layout;
     twin_text_metrics_t m;
     twin_coord_t w = _twin_widget_width(label);
     twin_coord_t h = _twin_widget_height(label);
 
-    if (path) {
+    if (path && (layout = _twin_label_layout(label, path))) {
         twin_fixed_t wf = twin_int_to_fixed(w);
         twin_fixed_t hf = twin_int_to_fixed(h);
         twin_fixed_t x = 0, y;
 
-        twin_path_set_font_size(path, label->font_size);
-        twin_path_set_font_style(path, label->font_style);
-        twin_text_metrics_utf8(path, label->label, &m);
+        twin_text_layout_metrics(layout, &m);
         y = (hf - (m.ascent + m.descent)) / 2 + m.ascent + label->offset.y;
         switch (label->align) {
         case TwinAlignLeft:
@@ -53,10 +64,11 @@ static void _twin_label_paint(twin_label_t *label)
         }
         x += label->offset.x;
         twin_path_move(path, x, y);
-        twin_path_utf8(path, label->label);
-        twin_paint_path(label->widget.window->pixmap, label->foreground, path);
-        twin_path_destroy(path);
+        twin_paint_text_layout(label->widget.window->pixmap, label->foreground,
+                               path, layout);
     }
+    if (path)
+        twin_path_destroy(path);
 }
 
 twin_dispatch_result_t _twin_label_dispatch(twin_widget_t *widget,
@@ -112,6 +124,7 @@ void _twin_label_init(twin_label_t *label,
     static const twin_widget_layout_t preferred = {0, 0, 1, 1};
     _twin_widget_init(&label->widget, parent, 0, preferred, dispatch);
     label->label = NULL;
+    label->layout = NULL;
     label->offset.x = 0;
     label->offset.y = 0;
     label->align = TwinAlignCenter;
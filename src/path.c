@@ -5,6 +5,7 @@
  */
 
 #include <stdlib.h>
+#include <string.h>
 
 #include "twin_private.h"
 
@@ -41,6 +42,22 @@ twin_spoint_t _twin_path_subpath_first_spoint(twin_path_t *path)
     return path->points[start];
 }
 
+/* Arena storage can't be resized in place, so it is copied instead */
+static void *_twin_path_grow(twin_path_t *path,
+                             void *data,
+                             size_t size,
+                             size_t new_size)
+{
+    void *grown;
+
+    if (!path->arena)
+        return realloc(data, new_size);
+    grown = twin_arena_alloc(path->arena, new_size);
+    if (grown && size)
+        memcpy(grown, data, size);
+    return grown;
+}
+
 void _twin_path_sfinish(twin_path_t *path)
 {
     switch (_twin_current_subpath_len(path)) {
@@ -58,10 +75,9 @@ void _twin_path_sfinish(twin_path_t *path)
             size_sublen = path->size_sublen * 2;
         else
             size_sublen = 1;
-        if (path->sublen)
-            sublen = realloc(path->sublen, size_sublen * sizeof(int));
-        else
-            sublen = malloc(size_sublen * sizeof(int));
+        sublen = _twin_path_grow(path, path->sublen,
+                                 path->size_sublen * sizeof(int),
+                                 size_sublen * sizeof(int));
         if (!sublen)
             return;
         path->sublen = sublen;
@@ -101,10 +117,9 @@ void _twin_path_sdraw(twin_path_t *path, twin_sfixed_t x, twin_sfixed_t y)
             size_points = path->size_points * 2;
         else
             size_points = 16;
-        if (path->points)
-            points = realloc(path->points, size_points * sizeof(twin_spoint_t));
-        else
-            points = malloc(size_points * sizeof(twin_spoint_t));
+        points = _twin_path_grow(path, path->points,
+                                 path->size_points * sizeof(twin_spoint_t),
+                                 size_points * sizeof(twin_spoint_t));
         if (!points)
             return;
         path->points = points;
@@ -364,6 +379,16 @@ twin_style_t twin_path_current_font_style(twin_path_t *path)
     return path->state.font_style;
 }
 
+twin_font_t *twin_path_current_font(twin_path_t *path)
+{
+    return _twin_path_font(path);
+}
+
+void twin_path_set_font(twin_path_t *path, twin_font_t *font)
+{
+    path->state.font = font;
+}
+
 void twin_path_set_cap_style(twin_path_t *path, twin_cap_t cap_style)
 {
     path->state.cap_style = cap_style;
@@ -374,6 +399,16 @@ twin_cap_t twin_path_current_cap_style(twin_path_t *path)
     return path->state.cap_style;
 }
 
+void twin_path_set_antialias(twin_path_t *path, twin_antialias_t antialias)
+{
+    path->state.antialias = antialias;
+}
+
+twin_antialias_t twin_path_current_antialias(twin_path_t *path)
+{
+    return path->state.antialias;
+}
+
 void twin_path_empty(twin_path_t *path)
 {
     path->npoints = 0;
@@ -429,11 +464,10 @@ void twin_path_restore(twin_path_t *path, twin_state_t *state)
     path->state = *state;
 }
 
-twin_path_t *twin_path_create(void)
+static twin_path_t *_twin_path_init(twin_path_t *path, twin_arena_t *arena)
 {
-    twin_path_t *path;
-
-    path = malloc(sizeof(twin_path_t));
+    if (!path)
+        return NULL;
     path->npoints = path->size_points = 0;
     path->nsublen = path->size_sublen = 0;
     path->points = 0;
@@ -442,16 +476,146 @@ twin_path_t *twin_path_create(void)
     path->state.font_size = TWIN_FIXED_ONE * 15;
     path->state.font_style = TwinStyleRoman;
     path->state.cap_style = TwinCapRound;
+    path->state.font = NULL;
+    path->state.antialias = TWIN_ANTIALIAS_DEFAULT;
+    path->arena = arena;
     return path;
 }
 
+twin_path_t *twin_path_create(void)
+{
+    return _twin_path_init(malloc(sizeof(twin_path_t)), NULL);
+}
+
+/*
+ * Paths from an arena, and everything they grow, are given back by
+ * resetting the arena; destroying them does nothing.
+ */
+twin_path_t *twin_path_create_arena(twin_arena_t *arena)
+{
+    return _twin_path_init(twin_arena_alloc(arena, sizeof(twin_path_t)),
+                           arena);
+}
+
+twin_path_t *_twin_path_create_scratch(const twin_path_t *path)
+{
+    twin_path_t *scratch = NULL;
+
+    if (path->arena)
+        scratch = twin_path_create_arena(path->arena);
+    return scratch ? scratch : twin_path_create();
+}
+
 void twin_path_destroy(twin_path_t *path)
 {
+    if (path->arena)
+        return;
     free(path->points);
     free(path->sublen);
     free(path);
 }
 
+#if defined(CONFIG_RENDERER_BUILTIN)
+/*
+ * OVER leaves pixels without coverage alone, so the rasterizer can hand
+ * each row to the compositor as it finishes it. Every row of the mask then
+ * shares one buffer, which is cleared behind the compositor.
+ */
+typedef struct _twin_path_spans {
+    twin_pixmap_t *dst;
+    twin_operand_t *src;
+    twin_coord_t src_x, src_y;
+    twin_coord_t x, y;
+    twin_a8_t *row;
+    twin_coord_t width;
+    twin_rect_t damage;
+} twin_path_spans_t;
+
+static twin_scratch_t _twin_path_row_scratch;
+static size_t _twin_path_row_clear;
+
+static void _twin_path_span(twin_coord_t y,
+                            twin_coord_t left,
+                            twin_coord_t right,
+                            void *closure)
+{
+    twin_path_spans_t *spans = closure;
+    twin_coord_t end;
+
+    /*
+     * Clear pixels leave dst alone, so pad the span to whole vectors
+     * rather than finishing it in the scalar kernels
+     */
+    end = left + ((right - left + 7) & ~7);
+    if (end > spans->width)
+        end = spans->width;
+    _twin_composite_span(spans->dst, spans->x + left, spans->y + y,
+                         spans->src, spans->src_x + left, spans->src_y + y,
+                         spans->row + left, TWIN_OVER, end - left);
+    memset(spans->row + left, 0, right - left);
+
+    if (spans->damage.left >= spans->damage.right) {
+        spans->damage.top = y;
+        spans->damage.left = left;
+        spans->damage.right = right;
+    }
+    if (left < spans->damage.left)
+        spans->damage.left = left;
+    if (right > spans->damage.right)
+        spans->damage.right = right;
+    spans->damage.bottom = y + 1;
+}
+
+static bool _twin_composite_path_spans(twin_pixmap_t *dst,
+                                       twin_operand_t *src,
+                                       twin_coord_t src_x,
+                                       twin_coord_t src_y,
+                                       twin_path_t *path,
+                                       const twin_rect_t *bounds)
+{
+    twin_coord_t width = bounds->right - bounds->left;
+    twin_coord_t height = bounds->bottom - bounds->top;
+    twin_path_spans_t spans = {
+        .dst = dst,
+        .src = src,
+        .src_x = src_x + bounds->left,
+        .src_y = src_y + bounds->top,
+        .x = bounds->left,
+        .y = bounds->top,
+        .width = width,
+    };
+    twin_pixmap_t mask;
+
+    spans.row = _twin_scratch_reserve(&_twin_path_row_scratch, width);
+    if (!spans.row)
+        return false;
+    if ((size_t) width > _twin_path_row_clear) {
+        memset(spans.row + _twin_path_row_clear, 0,
+               width - _twin_path_row_clear);
+        _twin_path_row_clear = width;
+    }
+
+    _twin_pixmap_init_const(&mask, TWIN_A8, width, height, 0,
+                            (twin_pointer_t){.a8 = spans.row});
+
+    /* only rasterize what dst will show */
+    twin_pixmap_clip(&mask, dst->clip.left - dst->origin_x - bounds->left,
+                     dst->clip.top - dst->origin_y - bounds->top,
+                     dst->clip.right - dst->origin_x - bounds->left,
+                     dst->clip.bottom - dst->origin_y - bounds->top);
+
+    _twin_fill_path_rows(&mask, path, -bounds->left, -bounds->top,
+                         _twin_path_span, &spans);
+
+    if (spans.damage.left < spans.damage.right)
+        twin_pixmap_damage(dst, spans.damage.left + spans.x + dst->origin_x,
+                           spans.damage.top + spans.y + dst->origin_y,
+                           spans.damage.right + spans.x + dst->origin_x,
+                           spans.damage.bottom + spans.y + dst->origin_y);
+    return true;
+}
+#endif
+
 void twin_composite_path(twin_pixmap_t *dst,
                          twin_operand_t *src,
                          twin_coord_t src_x,
@@ -464,6 +628,14 @@ void twin_composite_path(twin_pixmap_t *dst,
     if (bounds.left >= bounds.right || bounds.top >= bounds.bottom)
         return;
 
+#if defined(CONFIG_RENDERER_BUILTIN)
+    if (operator == TWIN_OVER &&
+        (src->source_kind == TWIN_SOLID ||
+         twin_matrix_is_identity(&src->u.pixmap->transform)) &&
+        _twin_composite_path_spans(dst, src, src_x, src_y, path, &bounds))
+        return;
+#endif
+
     twin_coord_t width = bounds.right - bounds.left;
     twin_coord_t height = bounds.bottom - bounds.top;
     twin_pixmap_t *mask = twin_pixmap_create(TWIN_A8, width, height);
@@ -491,14 +663,15 @@ void twin_composite_stroke(twin_pixmap_t *dst,
                            twin_fixed_t pen_width,
                            twin_operator_t operator)
 {
-    twin_path_t *pen = twin_path_create();
-    twin_path_t *path = twin_path_create();
+    twin_path_t *pen = _twin_path_create_scratch(stroke);
+    twin_path_t *path = _twin_path_create_scratch(stroke);
     twin_matrix_t m = twin_path_current_matrix(stroke);
 
     m.m[2][0] = 0;
     m.m[2][1] = 0;
     twin_path_set_matrix(pen, m);
     twin_path_set_cap_style(path, twin_path_current_cap_style(stroke));
+    twin_path_set_antialias(path, twin_path_current_antialias(stroke));
     twin_path_circle(pen, 0, 0, pen_width / 2);
     twin_path_convolve(path, stroke, pen);
     twin_composite_path(dst, src, src_x, src_y, path, operator);
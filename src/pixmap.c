@@ -13,6 +13,17 @@
     (((alignment) & ((alignment) - 1)) == 0                \
          ? (((sz) + (alignment) - 1) & ~((alignment) - 1)) \
          : ((((sz) + (alignment) - 1) / (alignment)) * (alignment)))
+/* RGB16 pixels carry no alpha, so such pixmaps are opaque throughout */
+static void _twin_pixmap_init_opaque(twin_pixmap_t *pixmap)
+{
+    pixmap->opaque.left = pixmap->opaque.top = 0;
+    pixmap->opaque.right = pixmap->opaque.bottom = 0;
+    if (pixmap->format == TWIN_RGB16) {
+        pixmap->opaque.right = pixmap->width;
+        pixmap->opaque.bottom = pixmap->height;
+    }
+}
+
 twin_pixmap_t *twin_pixmap_create(twin_format_t format,
                                   twin_coord_t width,
                                   twin_coord_t height)
@@ -36,10 +47,12 @@ twin_pixmap_t *twin_pixmap_create(twin_format_t format,
     pixmap->width = width;
     pixmap->height = height;
     twin_matrix_identity(&pixmap->transform);
+    pixmap->filter = TWIN_FILTER_BILINEAR;
     pixmap->clip.left = pixmap->clip.top = 0;
     pixmap->clip.right = pixmap->width - 1;
     pixmap->clip.bottom = pixmap->height;
     pixmap->origin_x = pixmap->origin_y = 0;
+    _twin_pixmap_init_opaque(pixmap);
     pixmap->stride = stride;
     pixmap->disable = 0;
     pixmap->animation = NULL;
@@ -49,16 +62,13 @@ twin_pixmap_t *twin_pixmap_create(twin_format_t format,
     return pixmap;
 }
 
-twin_pixmap_t *twin_pixmap_create_const(twin_format_t format,
-                                        twin_coord_t width,
-                                        twin_coord_t height,
-                                        twin_coord_t stride,
-                                        twin_pointer_t pixels)
+void _twin_pixmap_init_const(twin_pixmap_t *pixmap,
+                             twin_format_t format,
+                             twin_coord_t width,
+                             twin_coord_t height,
+                             twin_coord_t stride,
+                             twin_pointer_t pixels)
 {
-    twin_pixmap_t *pixmap = malloc(sizeof(twin_pixmap_t));
-    if (!pixmap)
-        return NULL;
-
     pixmap->screen = 0;
     pixmap->up = 0;
     pixmap->down = 0;
@@ -67,13 +77,30 @@ twin_pixmap_t *twin_pixmap_create_const(twin_format_t format,
     pixmap->width = width;
     pixmap->height = height;
     twin_matrix_identity(&pixmap->transform);
+    pixmap->filter = TWIN_FILTER_BILINEAR;
     pixmap->clip.left = pixmap->clip.top = 0;
     pixmap->clip.right = pixmap->width - 1;
     pixmap->clip.bottom = pixmap->height;
     pixmap->origin_x = pixmap->origin_y = 0;
+    _twin_pixmap_init_opaque(pixmap);
     pixmap->stride = stride;
     pixmap->disable = 0;
+    pixmap->animation = NULL;
+    pixmap->shadow = false;
     pixmap->p = pixels;
+}
+
+twin_pixmap_t *twin_pixmap_create_const(twin_format_t format,
+                                        twin_coord_t width,
+                                        twin_coord_t height,
+                                        twin_coord_t stride,
+                                        twin_pointer_t pixels)
+{
+    twin_pixmap_t *pixmap = malloc(sizeof(twin_pixmap_t));
+    if (!pixmap)
+        return NULL;
+
+    _twin_pixmap_init_const(pixmap, format, width, height, stride, pixels);
     return pixmap;
 }
 
@@ -103,15 +130,15 @@ void twin_pixmap_show(twin_pixmap_t *pixmap,
         pixmap->down = lower;
         pixmap->up = lower->up;
         lower->up = pixmap;
-        if (!pixmap->up)
-            screen->top = pixmap;
     } else {
         pixmap->down = NULL;
         pixmap->up = screen->bottom;
         screen->bottom = pixmap;
-        if (!pixmap->up)
-            screen->top = pixmap;
     }
+    if (pixmap->up)
+        pixmap->up->down = pixmap;
+    else
+        screen->top = pixmap;
 
     twin_pixmap_damage(pixmap, 0, 0, pixmap->width, pixmap->height);
 }
@@ -322,6 +349,116 @@ void twin_pixmap_move(twin_pixmap_t *pixmap, twin_coord_t x, twin_coord_t y)
     twin_pixmap_damage(pixmap, 0, 0, pixmap->width, pixmap->height);
 }
 
+void twin_pixmap_set_opaque(twin_pixmap_t *pixmap,
+                            twin_coord_t left,
+                            twin_coord_t top,
+                            twin_coord_t right,
+                            twin_coord_t bottom)
+{
+    if (left < 0)
+        left = 0;
+    if (top < 0)
+        top = 0;
+    if (right > pixmap->width)
+        right = pixmap->width;
+    if (bottom > pixmap->height)
+        bottom = pixmap->height;
+    if (left >= right || top >= bottom)
+        left = top = right = bottom = 0;
+
+    pixmap->opaque.left = left;
+    pixmap->opaque.top = top;
+    pixmap->opaque.right = right;
+    pixmap->opaque.bottom = bottom;
+}
+
+static twin_area_t _twin_rect_area(twin_coord_t left,
+                                   twin_coord_t top,
+                                   twin_coord_t right,
+                                   twin_coord_t bottom)
+{
+    return (twin_area_t) (right - left) * (bottom - top);
+}
+
+/*
+ * The area just drawn holds only opaque pixels now. Grow the opaque
+ * rectangle when the two line up, otherwise keep the larger of them.
+ */
+void _twin_pixmap_opaque_add(twin_pixmap_t *pixmap,
+                             twin_coord_t left,
+                             twin_coord_t top,
+                             twin_coord_t right,
+                             twin_coord_t bottom)
+{
+    twin_rect_t *o = &pixmap->opaque;
+
+    if (pixmap->format == TWIN_RGB16 || left >= right || top >= bottom)
+        return;
+
+    if (o->left <= left && right <= o->right && o->top <= top &&
+        bottom <= o->bottom)
+        return;
+
+    if (o->left == left && o->right == right && top <= o->bottom &&
+        o->top <= bottom) {
+        /* stacked vertically */
+        if (top > o->top)
+            top = o->top;
+        if (bottom < o->bottom)
+            bottom = o->bottom;
+    } else if (o->top == top && o->bottom == bottom && left <= o->right &&
+               o->left <= right) {
+        /* side by side */
+        if (left > o->left)
+            left = o->left;
+        if (right < o->right)
+            right = o->right;
+    } else if (_twin_rect_area(left, top, right, bottom) <
+               _twin_rect_area(o->left, o->top, o->right, o->bottom)) {
+        return;
+    }
+    twin_pixmap_set_opaque(pixmap, left, top, right, bottom);
+}
+
+/*
+ * The area just drawn may hold translucent pixels now. Keep the largest
+ * piece of the opaque rectangle that lies outside of it.
+ */
+void _twin_pixmap_opaque_remove(twin_pixmap_t *pixmap,
+                                twin_coord_t left,
+                                twin_coord_t top,
+                                twin_coord_t right,
+                                twin_coord_t bottom)
+{
+    twin_rect_t o = pixmap->opaque, best = {0, 0, 0, 0};
+    twin_rect_t pieces[4];
+    twin_area_t best_area = 0;
+    int n = 0;
+
+    if (pixmap->format == TWIN_RGB16 || right <= o.left || o.right <= left ||
+        bottom <= o.top || o.bottom <= top)
+        return;
+
+    if (o.top < top)
+        pieces[n++] = (twin_rect_t){o.left, o.right, o.top, top};
+    if (bottom < o.bottom)
+        pieces[n++] = (twin_rect_t){o.left, o.right, bottom, o.bottom};
+    if (o.left < left)
+        pieces[n++] = (twin_rect_t){o.left, left, o.top, o.bottom};
+    if (right < o.right)
+        pieces[n++] = (twin_rect_t){right, o.right, o.top, o.bottom};
+
+    for (int i = 0; i < n; i++) {
+        twin_area_t area = _twin_rect_area(pieces[i].left, pieces[i].top,
+                                           pieces[i].right, pieces[i].bottom);
+        if (area > best_area) {
+            best = pieces[i];
+            best_area = area;
+        }
+    }
+    pixmap->opaque = best;
+}
+
 bool twin_pixmap_dispatch(twin_pixmap_t *pixmap, twin_event_t *event)
 {
     if (pixmap->window)
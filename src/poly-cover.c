@@ -0,0 +1,336 @@
+/*
+ * Twin - A Tiny Window System
+ * Copyright (c) 2024 National Cheng Kung University, Taiwan
+ * All rights reserved.
+ */
+
+#include "twin_private.h"
+
+/*
+ * Area coverage rasterizer, after font-rs and stb_truetype 2.
+ *
+ * Rather than sampling the path on a sub-pixel grid, each edge adds the
+ * exact signed area it sweeps to the cells of every pixel row it crosses.
+ * A cell holds the change in coverage from its left neighbour, so the
+ * running sum along a row is the covered fraction of each pixel. Edges are
+ * visited once per row in no particular order, and each row is summed only
+ * over the cells its edges touched.
+ *
+ * The magnitude of the sum is clamped to full coverage, which is nonzero
+ * winding except within pixels where overlapping contours each cover only
+ * part of the pixel.
+ */
+
+/* Full coverage of a cell */
+#define TWIN_COVER_ONE (1 << 16)
+
+typedef struct _twin_cover_edge {
+    struct _twin_cover_edge *next;
+    twin_sfixed_t top, bot;
+    twin_fixed_t x;  /* at top */
+    int64_t dxdy;    /* x step per twin_sfixed_t of y, 32 bits of fraction */
+    int winding;
+} twin_cover_edge_t;
+
+/*
+ * Edges, the buckets sorting them by their first row and a row of cells,
+ * kept from one fill to the next. Rows are left cleared as they are
+ * resolved, so only cells added by growing the row need clearing
+ */
+static twin_scratch_t _twin_cover_edge_scratch;
+static twin_scratch_t _twin_cover_bucket_scratch;
+static twin_scratch_t _twin_cover_cell_scratch;
+static int _twin_cover_cells_clear;
+
+static twin_fixed_t _twin_cover_edge_x(const twin_cover_edge_t *edge, int y)
+{
+    return edge->x + (twin_fixed_t) (((y - edge->top) * edge->dxdy) >> 16);
+}
+
+static int _twin_cover_edge_build(twin_spoint_t *vertices,
+                                  int nvertices,
+                                  twin_cover_edge_t *edges,
+                                  twin_sfixed_t dx,
+                                  twin_sfixed_t dy,
+                                  const twin_rect_t *clip)
+{
+    int top_y = clip->top * TWIN_SFIXED_ONE;
+    int bot_y = clip->bottom * TWIN_SFIXED_ONE;
+    int left_x = clip->left * TWIN_SFIXED_ONE;
+    int right_x = clip->right * TWIN_SFIXED_ONE;
+    int e = 0;
+
+    for (int v = 0; v < nvertices; v++) {
+        int nv = v + 1;
+        int tv, bv;
+
+        if (nv == nvertices)
+            nv = 0;
+
+        /* skip horizontal edges */
+        if (vertices[v].y == vertices[nv].y)
+            continue;
+
+        if (vertices[v].y < vertices[nv].y) {
+            edges[e].winding = 1;
+            tv = v;
+            bv = nv;
+        } else {
+            edges[e].winding = -1;
+            tv = nv;
+            bv = v;
+        }
+
+        /* skip edges above or below the pixmap */
+        if (vertices[bv].y + dy <= top_y || vertices[tv].y + dy >= bot_y)
+            continue;
+
+        /*
+         * Area right of the pixmap is never seen, and area to its left
+         * lands in the first column however it is shaped
+         */
+        int tx = vertices[tv].x + dx;
+        int bx = vertices[bv].x + dx;
+        if (tx >= right_x && bx >= right_x)
+            continue;
+
+        edges[e].top = vertices[tv].y + dy;
+        edges[e].bot = vertices[bv].y + dy;
+        if (tx <= left_x && bx <= left_x) {
+            edges[e].x = twin_sfixed_to_fixed(left_x);
+            edges[e].dxdy = 0;
+            e++;
+            continue;
+        }
+        edges[e].x = twin_sfixed_to_fixed(tx);
+        edges[e].dxdy = ((int64_t) twin_sfixed_to_fixed(vertices[bv].x -
+                                                       vertices[tv].x)
+                         << 16) /
+                        (edges[e].bot - edges[e].top);
+        e++;
+    }
+    return e;
+}
+
+/* Add v to cell i, folding cells left of the row into the first one */
+static inline void _twin_cover_add(int32_t *cells, int width, int i, int32_t v)
+{
+    if (i < width)
+        cells[i < 0 ? 0 : i] += v;
+}
+
+/*
+ * Add the area swept by edge within the pixel row from y to y +
+ * TWIN_SFIXED_ONE to cells, which start at column left, and widen the
+ * touched range [*lo, *hi] to match. Each cell but the last is rounded on
+ * its own and the last one takes the remainder, so the row always sums to
+ * exactly the edge's signed height.
+ */
+static void _twin_cover_edge_row(const twin_cover_edge_t *edge,
+                                 int32_t *cells,
+                                 int width,
+                                 twin_fixed_t left,
+                                 int y,
+                                 int *lo,
+                                 int *hi)
+{
+    int ya = edge->top > y ? edge->top : y;
+    int yb = edge->bot < y + TWIN_SFIXED_ONE ? edge->bot : y + TWIN_SFIXED_ONE;
+    twin_fixed_t xa = _twin_cover_edge_x(edge, ya) - left;
+    twin_fixed_t xb = _twin_cover_edge_x(edge, yb) - left;
+    int32_t d = (yb - ya) * (TWIN_COVER_ONE / TWIN_SFIXED_ONE) * edge->winding;
+    twin_fixed_t x0 = xa < xb ? xa : xb;
+    twin_fixed_t x1 = xa < xb ? xb : xa;
+    int x0i = twin_fixed_floor(x0) >> 16;
+    int x1i = twin_fixed_ceil(x1) >> 16;
+
+    if (x0i >= width)
+        return;
+    if (x0i < *lo)
+        *lo = x0i < 0 ? 0 : x0i;
+    if (x1i > *hi)
+        *hi = x1i < width ? x1i : width - 1;
+
+    if (x1i <= x0i + 1) {
+        /* within one cell: split by the mean x */
+        twin_fixed_t xm = ((xa + xb) >> 1) - twin_int_to_fixed(x0i);
+        int32_t c = (int32_t) (((int64_t) d * xm) >> 16);
+
+        _twin_cover_add(cells, width, x0i, d - c);
+        _twin_cover_add(cells, width, x0i + 1, c);
+    } else {
+        twin_fixed_t w = x1 - x0;
+        twin_fixed_t x0f = TWIN_FIXED_ONE - (x0 - twin_int_to_fixed(x0i));
+        twin_fixed_t x1f = x1 - twin_int_to_fixed(x1i - 1);
+        int64_t s = ((int64_t) 1 << 32) / w;
+        int32_t ds = (int32_t) ((d * s) >> 16);
+        int32_t c0 = (int32_t) (((((int64_t) x0f * x0f) >> 1) / w * d) >> 16);
+        int32_t cm = (int32_t) (((((int64_t) x1f * x1f) >> 1) / w * d) >> 16);
+        int32_t rest = d - c0 - cm;
+        int n = x1i - x0i - 3;
+
+        /* partial cells at either end, whole cells in between */
+        _twin_cover_add(cells, width, x0i, c0);
+        if (n >= 0) {
+            int32_t c1 =
+                (int32_t) ((((s * (x0f + TWIN_FIXED_HALF)) >> 16) * d) >> 16) -
+                c0;
+            int i = x0i + 2;
+            int end = x1i - 1 < width ? x1i - 1 : width;
+
+            _twin_cover_add(cells, width, x0i + 1, c1);
+            rest -= c1 + n * ds;
+            if (i < 0) {
+                cells[0] += ((end < 0 ? end : 0) - i) * ds;
+                i = 0;
+            }
+            for (; i < end; i++)
+                cells[i] += ds;
+        }
+        _twin_cover_add(cells, width, x1i - 1, rest);
+        _twin_cover_add(cells, width, x1i, cm);
+    }
+}
+
+/*
+ * Sweep the pixel rows down from y, the row of the first bucket, which
+ * holds the edges starting there
+ */
+static void _twin_cover_fill(twin_pixmap_t *pixmap,
+                             twin_cover_edge_t **buckets,
+                             int nbuckets,
+                             int y,
+                             twin_row_proc_t row,
+                             void *closure)
+{
+    twin_coord_t left = pixmap->clip.left;
+    int width = pixmap->clip.right - left;
+    twin_cover_edge_t *active = NULL, *a, **prev;
+    int32_t *cells;
+
+    if (width <= 0)
+        return;
+    cells = _twin_scratch_reserve(&_twin_cover_cell_scratch,
+                                  sizeof(int32_t) * width);
+    if (!cells)
+        return;
+    if (width > _twin_cover_cells_clear) {
+        memset(cells + _twin_cover_cells_clear, 0,
+               sizeof(int32_t) * (width - _twin_cover_cells_clear));
+        _twin_cover_cells_clear = width;
+    }
+
+    for (int b = 0; y < pixmap->clip.bottom; y++, b++) {
+        int sy = y * TWIN_SFIXED_ONE;
+        int lo = width, hi = 0;
+        twin_a8_t *span;
+        int32_t sum;
+
+        /* add in new edges */
+        if (b < nbuckets && buckets[b]) {
+            for (a = buckets[b]; a->next; a = a->next)
+                ;
+            a->next = active;
+            active = buckets[b];
+        }
+
+        if (!active) {
+            int skip = b;
+
+            /* skip to the next edge */
+            while (b < nbuckets && !buckets[b])
+                b++;
+            if (b >= nbuckets)
+                break;
+            y += b - skip - 1;
+            b--;
+            continue;
+        }
+
+        /* accumulate this row, dropping edges which end in it */
+        for (prev = &active; (a = *prev);) {
+            _twin_cover_edge_row(a, cells, width, twin_int_to_fixed(left), sy,
+                                 &lo, &hi);
+            if (a->bot <= sy + TWIN_SFIXED_ONE)
+                *prev = a->next;
+            else
+                prev = &a->next;
+        }
+        if (lo > hi)
+            continue;
+
+        /* coverage left at the end was cut off by the clip */
+        span = pixmap->p.a8 + y * pixmap->stride + left;
+        sum = _twin_vec_cover_span(span + lo, cells + lo, hi - lo + 1, 0);
+        if (sum) {
+            _twin_vec_cover_span(span + hi + 1, cells + hi + 1, width - hi - 1,
+                                 sum);
+            hi = width - 1;
+        }
+        if (row)
+            (*row)(y, left + lo, left + hi + 1, closure);
+    }
+}
+
+void _twin_cover_fill_path(twin_pixmap_t *pixmap,
+                           twin_path_t *path,
+                           twin_sfixed_t dx,
+                           twin_sfixed_t dy,
+                           twin_row_proc_t row,
+                           void *closure)
+{
+    int nalloc = path->npoints + path->nsublen + 1;
+    twin_cover_edge_t *edges = _twin_scratch_reserve(
+        &_twin_cover_edge_scratch, sizeof(twin_cover_edge_t) * nalloc);
+    twin_cover_edge_t **buckets;
+    int p = 0;
+    int nedges = 0;
+    int top, bot;
+
+    if (!edges)
+        return;
+    for (int s = 0; s <= path->nsublen; s++) {
+        int sublen;
+        if (s == path->nsublen)
+            sublen = path->npoints;
+        else
+            sublen = path->sublen[s];
+        int npoints = sublen - p;
+        if (npoints > 1) {
+            nedges += _twin_cover_edge_build(path->points + p, npoints,
+                                             edges + nedges, dx, dy,
+                                             &pixmap->clip);
+            p = sublen;
+        }
+    }
+    if (!nedges)
+        return;
+
+    /* bucket the edges by the pixel row they start on */
+    top = bot = twin_sfixed_trunc(edges[0].top);
+    for (int e = 1; e < nedges; e++) {
+        int y = twin_sfixed_trunc(edges[e].top);
+        if (y < top)
+            top = y;
+        if (y > bot)
+            bot = y;
+    }
+    if (top < pixmap->clip.top)
+        top = pixmap->clip.top;
+    if (bot < top)
+        bot = top;
+    buckets = _twin_scratch_reserve(&_twin_cover_bucket_scratch,
+                                    sizeof(twin_cover_edge_t *) *
+                                        (bot - top + 1));
+    if (!buckets)
+        return;
+    memset(buckets, 0, sizeof(twin_cover_edge_t *) * (bot - top + 1));
+    for (int e = 0; e < nedges; e++) {
+        int b = twin_sfixed_trunc(edges[e].top) - top;
+        if (b < 0)
+            b = 0;
+        edges[e].next = buckets[b];
+        buckets[b] = &edges[e];
+    }
+    _twin_cover_fill(pixmap, buckets, bot - top + 1, top, row, closure);
+}
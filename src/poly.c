@@ -19,22 +19,15 @@ typedef struct _twin_edge {
     int winding;
 } twin_edge_t;
 
-#define TWIN_POLY_SHIFT 2
-#define TWIN_POLY_FIXED_SHIFT (4 - TWIN_POLY_SHIFT)
-#define TWIN_POLY_SAMPLE (1 << TWIN_POLY_SHIFT)
-#define TWIN_POLY_MASK (TWIN_POLY_SAMPLE - 1)
-#define TWIN_POLY_STEP (TWIN_SFIXED_ONE >> TWIN_POLY_SHIFT)
-#define TWIN_POLY_START (TWIN_POLY_STEP >> 1)
-#define TWIN_POLY_CEIL(c) (((c) + (TWIN_POLY_STEP - 1)) & ~(TWIN_POLY_STEP - 1))
-#define TWIN_POLY_COL(x) (((x) >> TWIN_POLY_FIXED_SHIFT) & TWIN_POLY_MASK)
-
-static int _edge_compare_y(const void *a, const void *b)
-{
-    const twin_edge_t *ae = a;
-    const twin_edge_t *be = b;
-
-    return (int) (ae->top - be->top);
-}
+/*
+ * The sample grid has 1 << shift rows and columns per pixel, with shift
+ * from 0 (aliased) to 3 (8x8) chosen by the path's antialias mode
+ */
+#define TWIN_POLY_FIXED_SHIFT(s) (4 - (s))
+#define TWIN_POLY_SAMPLE(s) (1 << (s))
+#define TWIN_POLY_MASK(s) (TWIN_POLY_SAMPLE(s) - 1)
+#define TWIN_POLY_STEP(s) (TWIN_SFIXED_ONE >> (s))
+#define TWIN_POLY_START(s) (TWIN_POLY_STEP(s) >> 1)
 
 static void _edge_step_by(twin_edge_t *edge, twin_sfixed_t dy)
 {
@@ -51,10 +44,35 @@ static void _edge_step_by(twin_edge_t *edge, twin_sfixed_t dy)
  * Grid coordinates are at TWIN_POLY_STEP/2 + n*TWIN_POLY_STEP
  */
 
-static twin_sfixed_t _twin_sfixed_grid_ceil(twin_sfixed_t f)
+static twin_sfixed_t _twin_sfixed_grid_ceil(twin_sfixed_t f, int shift)
+{
+    return ((f + (TWIN_POLY_START(shift) - 1)) &
+            ~(TWIN_POLY_STEP(shift) - 1)) +
+           TWIN_POLY_START(shift);
+}
+
+/*
+ * Edges and the scanline buckets sorting them live in storage kept from
+ * one fill to the next
+ */
+static twin_scratch_t _twin_edge_scratch;
+static twin_scratch_t _twin_bucket_scratch;
+
+void *_twin_scratch_reserve(twin_scratch_t *scratch, size_t size)
 {
-    return ((f + (TWIN_POLY_START - 1)) & ~(TWIN_POLY_STEP - 1)) +
-           TWIN_POLY_START;
+    if (size > scratch->size) {
+        size_t grow = scratch->size ? scratch->size : 256;
+        void *data;
+
+        while (grow < size)
+            grow *= 2;
+        data = realloc(scratch->data, grow);
+        if (!data)
+            return NULL;
+        scratch->data = data;
+        scratch->size = grow;
+    }
+    return scratch->data;
 }
 
 static int _twin_edge_build(twin_spoint_t *vertices,
@@ -62,8 +80,13 @@ static int _twin_edge_build(twin_spoint_t *vertices,
                             twin_edge_t *edges,
                             twin_sfixed_t dx,
                             twin_sfixed_t dy,
-                            twin_sfixed_t top_y)
+                            const twin_rect_t *clip,
+                            int shift)
 {
+    twin_sfixed_t top_y = twin_int_to_sfixed(clip->top);
+    twin_sfixed_t left_x = twin_int_to_sfixed(clip->left);
+    twin_sfixed_t right_x = twin_int_to_sfixed(clip->right);
+    int bot_y = clip->bottom * TWIN_SFIXED_ONE;
     int tv, bv;
 
     int e = 0;
@@ -88,14 +111,36 @@ static int _twin_edge_build(twin_spoint_t *vertices,
         }
 
         /* snap top to first grid point in pixmap */
-        twin_sfixed_t y = _twin_sfixed_grid_ceil(vertices[tv].y + dy);
-        if (y < TWIN_POLY_START + top_y)
-            y = TWIN_POLY_START + top_y;
+        twin_sfixed_t y = _twin_sfixed_grid_ceil(vertices[tv].y + dy, shift);
+        if (y < TWIN_POLY_START(shift) + top_y)
+            y = TWIN_POLY_START(shift) + top_y;
 
-        /* skip vertices which don't span a sample row */
-        if (y >= vertices[bv].y + dy)
+        /* skip vertices which don't span a sample row in the pixmap */
+        if (y >= vertices[bv].y + dy || y >= bot_y)
             continue;
 
+        edges[e].top = vertices[tv].y + dy;
+        edges[e].bot = vertices[bv].y + dy;
+        edges[e].x = vertices[tv].x + dx;
+        edges[e].e = 0;
+
+        /*
+         * An edge wholly beside the pixmap only adds its winding to spans
+         * which are clipped there anyway, so stand it up along the clip
+         */
+        twin_sfixed_t bx = vertices[bv].x + dx;
+        if ((edges[e].x <= left_x && bx <= left_x) ||
+            (edges[e].x >= right_x && bx >= right_x)) {
+            edges[e].x = edges[e].x <= left_x ? left_x : right_x;
+            edges[e].dx = 0;
+            edges[e].dy = 1;
+            edges[e].inc_x = 1;
+            edges[e].step_x = 0;
+            edges[e].top = y;
+            e++;
+            continue;
+        }
+
         /* Compute bresenham terms */
         edges[e].dx = vertices[bv].x - vertices[tv].x;
         edges[e].dy = vertices[bv].y - vertices[tv].y;
@@ -108,12 +153,6 @@ static int _twin_edge_build(twin_spoint_t *vertices,
         edges[e].step_x = edges[e].inc_x * (edges[e].dx / edges[e].dy);
         edges[e].dx = edges[e].dx % edges[e].dy;
 
-        edges[e].top = vertices[tv].y + dy;
-        edges[e].bot = vertices[bv].y + dy;
-
-        edges[e].x = vertices[tv].x + dx;
-        edges[e].e = 0;
-
         /* step to first grid point */
         _edge_step_by(&edges[e], y - edges[e].top);
 
@@ -123,44 +162,53 @@ static int _twin_edge_build(twin_spoint_t *vertices,
     return e;
 }
 
-static void _span_fill(twin_pixmap_t *pixmap,
-                       twin_sfixed_t y,
-                       twin_sfixed_t left,
-                       twin_sfixed_t right)
+/* 1x1 */
+static const twin_a8_t _twin_poly_coverage_1[1][1] = {
+    {0xff},
+};
+
+/* 2x2 */
+static const twin_a8_t _twin_poly_coverage_2[2][2] = {
+    {0x40, 0x40},
+    {0x3f, 0x40},
+};
+
+/* 4x4 */
+static const twin_a8_t _twin_poly_coverage_4[4][4] = {
+    {0x10, 0x10, 0x10, 0x10},
+    {0x10, 0x10, 0x10, 0x10},
+    {0x0f, 0x10, 0x10, 0x10},
+    {0x10, 0x10, 0x10, 0x10},
+};
+
+/* 8x8 */
+static const twin_a8_t _twin_poly_coverage_8[8][8] = {
+    {4, 4, 4, 4, 4, 4, 4, 4}, {4, 4, 4, 4, 4, 4, 4, 4},
+    {4, 4, 4, 4, 4, 4, 4, 4}, {4, 4, 4, 4, 4, 4, 4, 4},
+    {3, 4, 4, 4, 4, 4, 4, 4}, {4, 4, 4, 4, 4, 4, 4, 4},
+    {4, 4, 4, 4, 4, 4, 4, 4}, {4, 4, 4, 4, 4, 4, 4, 4},
+};
+
+/* Indexed by shift, each row of samples in turn */
+static const twin_a8_t *const _twin_poly_coverage[] = {
+    _twin_poly_coverage_1[0],
+    _twin_poly_coverage_2[0],
+    _twin_poly_coverage_4[0],
+    _twin_poly_coverage_8[0],
+};
+
+static inline void _span_fill(twin_pixmap_t *pixmap,
+                              twin_sfixed_t y,
+                              twin_sfixed_t left,
+                              twin_sfixed_t right,
+                              int shift,
+                              int *lo,
+                              int *hi)
 {
-#if TWIN_POLY_SHIFT == 0
-    /* 1x1 */
-    static const twin_a8_t coverage[1][1] = {
-        {0xff},
-    };
-#endif
-#if TWIN_POLY_SHIFT == 1
-    /* 2x2 */
-    static const twin_a8_t coverage[2][2] = {
-        {0x40, 0x40},
-        {0x3f, 0x40},
-    };
-#endif
-#if TWIN_POLY_SHIFT == 2
-    /* 4x4 */
-    static const twin_a8_t coverage[4][4] = {
-        {0x10, 0x10, 0x10, 0x10},
-        {0x10, 0x10, 0x10, 0x10},
-        {0x0f, 0x10, 0x10, 0x10},
-        {0x10, 0x10, 0x10, 0x10},
-    };
-#endif
-#if TWIN_POLY_SHIFT == 3
-    /* 8x8 */
-    static const twin_a8_t coverage[8][8] = {
-        {4, 4, 4, 4, 4, 4, 4, 4}, {4, 4, 4, 4, 4, 4, 4, 4},
-        {4, 4, 4, 4, 4, 4, 4, 4}, {4, 4, 4, 4, 4, 4, 4, 4},
-        {3, 4, 4, 4, 4, 4, 4, 4}, {4, 4, 4, 4, 4, 4, 4, 4},
-        {4, 4, 4, 4, 4, 4, 4, 4}, {4, 4, 4, 4, 4, 4, 4, 4},
-    };
-#endif
     const twin_a8_t *cover =
-        coverage[(y >> TWIN_POLY_FIXED_SHIFT) & TWIN_POLY_MASK];
+        _twin_poly_coverage[shift] +
+        ((((y >> TWIN_POLY_FIXED_SHIFT(shift)) & TWIN_POLY_MASK(shift)))
+         << shift);
     int row = twin_sfixed_trunc(y);
     twin_a8_t *span = pixmap->p.a8 + row * pixmap->stride;
     twin_a8_t *s;
@@ -177,23 +225,29 @@ static void _span_fill(twin_pixmap_t *pixmap,
         right = twin_int_to_sfixed(pixmap->clip.right);
 
     /* convert to sample grid */
-    left = _twin_sfixed_grid_ceil(left) >> TWIN_POLY_FIXED_SHIFT;
-    right = _twin_sfixed_grid_ceil(right) >> TWIN_POLY_FIXED_SHIFT;
+    left = _twin_sfixed_grid_ceil(left, shift) >> TWIN_POLY_FIXED_SHIFT(shift);
+    right =
+        _twin_sfixed_grid_ceil(right, shift) >> TWIN_POLY_FIXED_SHIFT(shift);
 
     /* check for empty */
     if (right <= left)
         return;
 
+    if (left >> shift < *lo)
+        *lo = left >> shift;
+    if (((right - 1) >> shift) + 1 > *hi)
+        *hi = ((right - 1) >> shift) + 1;
+
     x = left;
 
     /* starting address */
-    s = span + (x >> TWIN_POLY_SHIFT);
+    s = span + (x >> shift);
 
     /* first pixel */
-    if (x & TWIN_POLY_MASK) {
+    if (x & TWIN_POLY_MASK(shift)) {
         w = 0;
         col = 0;
-        while (x < right && (x & TWIN_POLY_MASK)) {
+        while (x < right && (x & TWIN_POLY_MASK(shift))) {
             w += cover[col++];
             x++;
         }
@@ -202,18 +256,18 @@ static void _span_fill(twin_pixmap_t *pixmap,
     }
 
     w = 0;
-    for (col = 0; col < TWIN_POLY_SAMPLE; col++)
+    for (col = 0; col < TWIN_POLY_SAMPLE(shift); col++)
         w += cover[col];
 
     /* middle pixels */
-    while (x + TWIN_POLY_MASK < right) {
+    while (x + TWIN_POLY_MASK(shift) < right) {
         a = *s + w;
         *s++ = twin_sat(a);
-        x += TWIN_POLY_SAMPLE;
+        x += TWIN_POLY_SAMPLE(shift);
     }
 
     /* last pixel */
-    if (right & TWIN_POLY_MASK) {
+    if (right & TWIN_POLY_MASK(shift)) {
         w = 0;
         col = 0;
         while (x < right) {
@@ -225,26 +279,46 @@ static void _span_fill(twin_pixmap_t *pixmap,
     }
 }
 
-static void _twin_edge_fill(twin_pixmap_t *pixmap,
-                            twin_edge_t *edges,
-                            int nedges)
+/*
+ * Sweep the sample rows down from y, the row of the first bucket, which
+ * holds the edges starting there
+ */
+static inline void _twin_edge_fill(twin_pixmap_t *pixmap,
+                                   twin_edge_t **buckets,
+                                   int nbuckets,
+                                   twin_sfixed_t y,
+                                   int shift,
+                                   twin_row_proc_t row,
+                                   void *closure)
 {
     twin_edge_t *active, *a, *n, **prev;
     twin_sfixed_t x0 = 0;
+    int ry = twin_sfixed_trunc(y);
+    int lo = pixmap->clip.right, hi = pixmap->clip.left;
 
-    qsort(edges, nedges, sizeof(twin_edge_t), _edge_compare_y);
-    int e = 0;
-    twin_sfixed_t y = edges[0].top;
+    int b = 0;
     active = 0;
     for (;;) {
+        /* hand back the pixel row when the samples leave it */
+        if (row && twin_sfixed_trunc(y) != ry) {
+            if (lo < hi)
+                (*row)(ry, lo, hi, closure);
+            ry = twin_sfixed_trunc(y);
+            lo = pixmap->clip.right;
+            hi = pixmap->clip.left;
+        }
+
         /* add in new edges */
-        for (; e < nedges && edges[e].top <= y; e++) {
+        for (twin_edge_t *edge = b < nbuckets ? buckets[b] : NULL; edge;
+             edge = n) {
+            n = edge->next;
             for (prev = &active; (a = *prev); prev = &(a->next))
-                if (a->x > edges[e].x)
+                if (a->x > edge->x)
                     break;
-            edges[e].next = *prev;
-            *prev = &edges[e];
+            edge->next = *prev;
+            *prev = edge;
         }
+        b++;
 
         /* walk this y value marking coverage */
         int w = 0;
@@ -253,11 +327,11 @@ static void _twin_edge_fill(twin_pixmap_t *pixmap,
                 x0 = a->x;
             w += a->winding;
             if (w == 0)
-                _span_fill(pixmap, y, x0, a->x);
+                _span_fill(pixmap, y, x0, a->x, shift, &lo, &hi);
         }
 
         /* step down, clipping to pixmap */
-        y += TWIN_POLY_STEP;
+        y += TWIN_POLY_STEP(shift);
 
         if (twin_sfixed_trunc(y) >= pixmap->clip.bottom)
             break;
@@ -270,13 +344,21 @@ static void _twin_edge_fill(twin_pixmap_t *pixmap,
                 prev = &a->next;
         }
 
-        /* check for all done */
-        if (!active && e == nedges)
-            break;
+        /* skip empty rows, checking for all done */
+        if (!active) {
+            int skip = b;
+
+            while (b < nbuckets && !buckets[b])
+                b++;
+            if (b >= nbuckets)
+                break;
+            y += (b - skip) * TWIN_POLY_STEP(shift);
+            continue;
+        }
 
         /* step all edges */
         for (a = active; a; a = a->next)
-            _edge_step_by(a, TWIN_POLY_STEP);
+            _edge_step_by(a, TWIN_POLY_STEP(shift));
 
         /* fix x sorting */
         for (prev = &active; (a = *prev) && (n = a->next);) {
@@ -289,18 +371,44 @@ static void _twin_edge_fill(twin_pixmap_t *pixmap,
                 prev = &a->next;
         }
     }
+    if (row && lo < hi)
+        (*row)(ry, lo, hi, closure);
 }
-
-void twin_fill_path(twin_pixmap_t *pixmap,
-                    twin_path_t *path,
-                    twin_coord_t dx,
-                    twin_coord_t dy)
+void _twin_fill_path_rows(twin_pixmap_t *pixmap,
+                          twin_path_t *path,
+                          twin_coord_t dx,
+                          twin_coord_t dy,
+                          twin_row_proc_t row,
+                          void *closure)
 {
     twin_sfixed_t sdx = twin_int_to_sfixed(dx + pixmap->origin_x);
     twin_sfixed_t sdy = twin_int_to_sfixed(dy + pixmap->origin_y);
 
+    int shift;
+
+    switch (path->state.antialias) {
+    case TwinAntialiasArea:
+        _twin_cover_fill_path(pixmap, path, sdx, sdy, row, closure);
+        return;
+    case TwinAntialiasNone:
+        shift = 0;
+        break;
+    case TwinAntialias2x2:
+        shift = 1;
+        break;
+    case TwinAntialias8x8:
+        shift = 3;
+        break;
+    default:
+        shift = 2;
+        break;
+    }
+
     int nalloc = path->npoints + path->nsublen + 1;
-    twin_edge_t *edges = malloc(sizeof(twin_edge_t) * nalloc);
+    twin_edge_t *edges = _twin_scratch_reserve(&_twin_edge_scratch,
+                                               sizeof(twin_edge_t) * nalloc);
+    if (!edges)
+        return;
     int p = 0;
     int nedges = 0;
     for (int s = 0; s <= path->nsublen; s++) {
@@ -311,13 +419,59 @@ void twin_fill_path(twin_pixmap_t *pixmap,
             sublen = path->sublen[s];
         int npoints = sublen - p;
         if (npoints > 1) {
-            int n =
-                _twin_edge_build(path->points + p, npoints, edges + nedges, sdx,
-                                 sdy, twin_int_to_sfixed(pixmap->clip.top));
+            int n = _twin_edge_build(path->points + p, npoints, edges + nedges,
+                                     sdx, sdy, &pixmap->clip, shift);
             p = sublen;
             nedges += n;
         }
     }
-    _twin_edge_fill(pixmap, edges, nedges);
-    free(edges);
+    if (!nedges)
+        return;
+
+    /*
+     * Bucket the edges by the sample row they start on, keeping path order
+     * within each so equal edges enter the active list as they always have
+     */
+    twin_sfixed_t top = edges[0].top, bot = edges[0].top;
+    for (int e = 1; e < nedges; e++) {
+        if (edges[e].top < top)
+            top = edges[e].top;
+        if (edges[e].top > bot)
+            bot = edges[e].top;
+    }
+    int nbuckets = ((bot - top) >> TWIN_POLY_FIXED_SHIFT(shift)) + 1;
+    twin_edge_t **buckets = _twin_scratch_reserve(
+        &_twin_bucket_scratch, sizeof(twin_edge_t *) * nbuckets);
+    if (!buckets)
+        return;
+    memset(buckets, 0, sizeof(twin_edge_t *) * nbuckets);
+    for (int e = nedges; e--;) {
+        int b = (edges[e].top - top) >> TWIN_POLY_FIXED_SHIFT(shift);
+        edges[e].next = buckets[b];
+        buckets[b] = &edges[e];
+    }
+
+    /* expand the sampler for each grid so the shifts are constants */
+    switch (shift) {
+    case 0:
+        _twin_edge_fill(pixmap, buckets, nbuckets, top, 0, row, closure);
+        break;
+    case 1:
+        _twin_edge_fill(pixmap, buckets, nbuckets, top, 1, row, closure);
+        break;
+    case 2:
+        _twin_edge_fill(pixmap, buckets, nbuckets, top, 2, row, closure);
+        break;
+    default:
+        _twin_edge_fill(pixmap, buckets, nbuckets, top, 3, row, closure);
+        break;
+    }
+}
+
+void twin_fill_path(twin_pixmap_t *pixmap,
+                    twin_path_t *path,
+                    twin_coord_t dx,
+                    twin_coord_t dy)
+{
+    _twin_fill_path_rows(pixmap, path, dx, dy, NULL, NULL);
 }
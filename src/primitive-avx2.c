@@ -0,0 +1,126 @@
+/*
+ * Twin - A Tiny Window System
+ * Copyright (c) 2024 National Cheng Kung University, Taiwan
+ * All rights reserved.
+ */
+
+#include <immintrin.h>
+
+#include "twin_private.h"
+
+typedef __m256i vec_t;
+
+#define VEC_PIXELS 8
+#define VEC_NAME(n) _twin_avx2_##n
+
+static inline vec_t vec_load(const twin_argb32_t *p)
+{
+    return _mm256_loadu_si256((const __m256i *) p);
+}
+
+static inline void vec_store(twin_argb32_t *p, vec_t v)
+{
+    _mm256_storeu_si256((__m256i *) p, v);
+}
+
+static inline vec_t vec_splat(twin_argb32_t v)
+{
+    return _mm256_set1_epi32((int) v);
+}
+
+static inline vec_t vec_a8(const twin_a8_t *p)
+{
+    return _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *) p));
+}
+
+static inline vec_t vec_spread(vec_t v)
+{
+    const __m256i idx =
+        _mm256_setr_epi8(0, 0, 0, 0, 4, 4, 4, 4, 8, 8, 8, 8, 12, 12, 12, 12, 0,
+                         0, 0, 0, 4, 4, 4, 4, 8, 8, 8, 8, 12, 12, 12, 12);
+    return _mm256_shuffle_epi8(v, idx);
+}
+
+static inline vec_t vec_alpha(vec_t v)
+{
+    const __m256i idx =
+        _mm256_setr_epi8(3, 3, 3, 3, 7, 7, 7, 7, 11, 11, 11, 11, 15, 15, 15, 15,
+                         3, 3, 3, 3, 7, 7, 7, 7, 11, 11, 11, 11, 15, 15, 15, 15);
+    return _mm256_shuffle_epi8(v, idx);
+}
+
+static inline vec_t vec_shl24(vec_t v)
+{
+    return _mm256_slli_epi32(v, 24);
+}
+
+/* (t + (t >> 8)) >> 8 == (t * 0x101) >> 16 for 16-bit t */
+static inline vec_t vec_mul(vec_t v, vec_t m)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i half = _mm256_set1_epi16(0x80);
+    const __m256i div = _mm256_set1_epi16(0x101);
+    __m256i lo, hi;
+
+    lo = _mm256_mullo_epi16(_mm256_unpacklo_epi8(v, zero),
+                            _mm256_unpacklo_epi8(m, zero));
+    hi = _mm256_mullo_epi16(_mm256_unpackhi_epi8(v, zero),
+                            _mm256_unpackhi_epi8(m, zero));
+    lo = _mm256_mulhi_epu16(_mm256_add_epi16(lo, half), div);
+    hi = _mm256_mulhi_epu16(_mm256_add_epi16(hi, half), div);
+    return _mm256_packus_epi16(lo, hi);
+}
+
+static inline vec_t vec_adds(vec_t a, vec_t b)
+{
+    return _mm256_adds_epu8(a, b);
+}
+
+static inline vec_t vec_not(vec_t v)
+{
+    return _mm256_xor_si256(v, _mm256_set1_epi32(-1));
+}
+
+/*
+ * Prefix sums of 8 cells at a time: two shifted adds sum within each
+ * 128-bit lane, then the low lane's total is added to the high lane.
+ */
+static int32_t VEC_NAME(cover)(twin_a8_t *dst,
+                               int32_t *cells,
+                               int width,
+                               int32_t sum)
+{
+    const __m256i last = _mm256_set1_epi32(7);
+    const __m256i half = _mm256_set1_epi32(0x80);
+    __m256i carry = _mm256_set1_epi32(sum);
+
+    for (; width >= 8; width -= 8) {
+        __m256i v = _mm256_loadu_si256((const __m256i *) cells);
+        __m128i a;
+
+        v = _mm256_add_epi32(v, _mm256_slli_si256(v, 4));
+        v = _mm256_add_epi32(v, _mm256_slli_si256(v, 8));
+        v = _mm256_add_epi32(
+            v, _mm256_shuffle_epi32(_mm256_permute2x128_si256(v, v, 0x08),
+                                    _MM_SHUFFLE(3, 3, 3, 3)));
+        v = _mm256_add_epi32(v, carry);
+        carry = _mm256_permutevar8x32_epi32(v, last);
+        _mm256_storeu_si256((__m256i *) cells, _mm256_setzero_si256());
+
+        v = _mm256_abs_epi32(v);
+        v = _mm256_sub_epi32(v, _mm256_srli_epi32(v, 8));
+        v = _mm256_srli_epi32(_mm256_add_epi32(v, half), 8);
+        v = _mm256_packs_epi32(v, v);
+        v = _mm256_packus_epi16(v, v);
+        a = _mm_unpacklo_epi32(_mm256_castsi256_si128(v),
+                               _mm256_extracti128_si256(v, 1));
+        a = _mm_adds_epu8(a, _mm_loadl_epi64((const __m128i *) dst));
+        _mm_storel_epi64((__m128i *) dst, a);
+        cells += 8;
+        dst += 8;
+    }
+    sum = _mm_cvtsi128_si32(_mm256_castsi256_si128(carry));
+    return width ? _twin_cover_span(dst, cells, width, sum) : sum;
+}
+
+#include "primitive-vec.h"
@@ -0,0 +1,66 @@
+/*
+ * Twin - A Tiny Window System
+ * Copyright (c) 2024 National Cheng Kung University, Taiwan
+ * All rights reserved.
+ */
+
+#include "twin_private.h"
+
+/*
+ * Pick the widest kernel set the running CPU supports.  The probe runs
+ * once; NULL means only the scalar kernels in primitive.c are available.
+ */
+const twin_simd_ops_t *_twin_simd_ops(void)
+{
+    static bool probed;
+    static const twin_simd_ops_t *ops;
+
+    if (probed)
+        return ops;
+    probed = true;
+
+#if defined(TWIN_HAVE_X86_SIMD)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        ops = &_twin_avx2_ops;
+    else if (__builtin_cpu_supports("sse2"))
+        ops = &_twin_sse2_ops;
+#endif
+    return ops;
+}
+
+void _twin_vec_argb32_over_argb32(twin_pointer_t dst,
+                                  twin_source_u src,
+                                  int width)
+{
+    const twin_simd_ops_t *ops = _twin_simd_ops();
+
+    if (ops)
+        ops->comp2[TWIN_OVER][TWIN_ARGB32](dst, src, width);
+    else
+        _twin_argb32_over_argb32(dst, src, width);
+}
+
+void _twin_vec_argb32_source_argb32(twin_pointer_t dst,
+                                    twin_source_u src,
+                                    int width)
+{
+    const twin_simd_ops_t *ops = _twin_simd_ops();
+
+    if (ops)
+        ops->comp2[TWIN_SOURCE][TWIN_ARGB32](dst, src, width);
+    else
+        _twin_argb32_source_argb32(dst, src, width);
+}
+
+int32_t _twin_vec_cover_span(twin_a8_t *dst,
+                             int32_t *cells,
+                             int width,
+                             int32_t sum)
+{
+    const twin_simd_ops_t *ops = _twin_simd_ops();
+
+    if (ops)
+        return ops->cover(dst, cells, width, sum);
+    return _twin_cover_span(dst, cells, width, sum);
+}
@@ -0,0 +1,125 @@
+/*
+ * Twin - A Tiny Window System
+ * Copyright (c) 2024 National Cheng Kung University, Taiwan
+ * All rights reserved.
+ */
+
+#include <emmintrin.h>
+
+#include "twin_private.h"
+
+typedef __m128i vec_t;
+
+#define VEC_PIXELS 4
+#define VEC_NAME(n) _twin_sse2_##n
+
+static inline vec_t vec_load(const twin_argb32_t *p)
+{
+    return _mm_loadu_si128((const __m128i *) p);
+}
+
+static inline void vec_store(twin_argb32_t *p, vec_t v)
+{
+    _mm_storeu_si128((__m128i *) p, v);
+}
+
+static inline vec_t vec_splat(twin_argb32_t v)
+{
+    return _mm_set1_epi32((int) v);
+}
+
+static inline vec_t vec_a8(const twin_a8_t *p)
+{
+    const __m128i zero = _mm_setzero_si128();
+    uint32_t m;
+
+    memcpy(&m, p, sizeof(m));
+    return _mm_unpacklo_epi16(
+        _mm_unpacklo_epi8(_mm_cvtsi32_si128((int) m), zero), zero);
+}
+
+static inline vec_t vec_spread(vec_t v)
+{
+    v = _mm_or_si128(v, _mm_slli_epi32(v, 8));
+    return _mm_or_si128(v, _mm_slli_epi32(v, 16));
+}
+
+static inline vec_t vec_alpha(vec_t v)
+{
+    return vec_spread(_mm_srli_epi32(v, 24));
+}
+
+static inline vec_t vec_shl24(vec_t v)
+{
+    return _mm_slli_epi32(v, 24);
+}
+
+/* (t + (t >> 8)) >> 8 == (t * 0x101) >> 16 for 16-bit t */
+static inline vec_t vec_mul(vec_t v, vec_t m)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i half = _mm_set1_epi16(0x80);
+    const __m128i div = _mm_set1_epi16(0x101);
+    __m128i lo, hi;
+
+    lo = _mm_mullo_epi16(_mm_unpacklo_epi8(v, zero),
+                         _mm_unpacklo_epi8(m, zero));
+    hi = _mm_mullo_epi16(_mm_unpackhi_epi8(v, zero),
+                         _mm_unpackhi_epi8(m, zero));
+    lo = _mm_mulhi_epu16(_mm_add_epi16(lo, half), div);
+    hi = _mm_mulhi_epu16(_mm_add_epi16(hi, half), div);
+    return _mm_packus_epi16(lo, hi);
+}
+
+static inline vec_t vec_adds(vec_t a, vec_t b)
+{
+    return _mm_adds_epu8(a, b);
+}
+
+static inline vec_t vec_not(vec_t v)
+{
+    return _mm_xor_si128(v, _mm_set1_epi32(-1));
+}
+
+/*
+ * Prefix sums of 4 cells at a time by two shifted adds, with the last sum
+ * carried into the next 4 in every lane. The packs saturate the scaled
+ * magnitudes to 0xff.
+ */
+static int32_t VEC_NAME(cover)(twin_a8_t *dst,
+                               int32_t *cells,
+                               int width,
+                               int32_t sum)
+{
+    const __m128i half = _mm_set1_epi32(0x80);
+    __m128i carry = _mm_set1_epi32(sum);
+
+    for (; width >= 4; width -= 4) {
+        __m128i v = _mm_loadu_si128((const __m128i *) cells);
+        __m128i s;
+        uint32_t a;
+
+        v = _mm_add_epi32(v, _mm_slli_si128(v, 4));
+        v = _mm_add_epi32(v, _mm_slli_si128(v, 8));
+        v = _mm_add_epi32(v, carry);
+        carry = _mm_shuffle_epi32(v, _MM_SHUFFLE(3, 3, 3, 3));
+        _mm_storeu_si128((__m128i *) cells, _mm_setzero_si128());
+
+        s = _mm_srai_epi32(v, 31);
+        v = _mm_sub_epi32(_mm_xor_si128(v, s), s);
+        v = _mm_add_epi32(_mm_sub_epi32(v, _mm_srli_epi32(v, 8)), half);
+        v = _mm_srli_epi32(v, 8);
+        v = _mm_packs_epi32(v, v);
+        v = _mm_packus_epi16(v, v);
+        memcpy(&a, dst, sizeof(a));
+        v = _mm_adds_epu8(v, _mm_cvtsi32_si128((int) a));
+        a = (uint32_t) _mm_cvtsi128_si32(v);
+        memcpy(dst, &a, sizeof(a));
+        cells += 4;
+        dst += 4;
+    }
+    sum = _mm_cvtsi128_si32(carry);
+    return width ? _twin_cover_span(dst, cells, width, sum) : sum;
+}
+
+#include "primitive-vec.h"
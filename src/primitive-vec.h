@@ -0,0 +1,238 @@
+/*
+ * Twin - A Tiny Window System
+ * Copyright (c) 2024 National Cheng Kung University, Taiwan
+ * All rights reserved.
+ */
+
+/*
+ * Vectorized compositing kernels for ARGB32 destinations.
+ *
+ * This is a template, included once per instruction set by
+ * primitive-sse2.c and primitive-avx2.c.  The includer defines:
+ *
+ *   vec_t                  a vector of VEC_PIXELS ARGB32 pixels
+ *   VEC_NAME(n)            decorated name for kernel n
+ *   vec_load(p)/vec_store  unaligned load/store of VEC_PIXELS pixels
+ *   vec_splat(v)           v in every pixel
+ *   vec_a8(p)              VEC_PIXELS A8 values, zero extended to 32 bits
+ *   vec_spread(v)          replicate the low byte of each pixel
+ *   vec_alpha(v)           replicate the alpha byte of each pixel
+ *   vec_shl24(v)           shift each pixel left by 24 bits
+ *   vec_mul(v, m)          per byte twin_int_mult(v, m)
+ *   vec_adds(a, b)         per byte saturating add
+ *   vec_not(v)             bitwise complement
+ *   VEC_NAME(cover)        _twin_cover_span() for the instruction set
+ *
+ * The arithmetic matches in_over()/in()/over() in primitive.c bit for bit,
+ * so the scalar kernels finish whatever is left of a span once it no
+ * longer fills a whole vector.
+ */
+
+static inline vec_t vec_over(vec_t dst, vec_t src)
+{
+    return vec_adds(vec_mul(dst, vec_not(vec_alpha(src))), src);
+}
+
+static inline vec_t vec_fetch_argb32(twin_argb32_t **p)
+{
+    vec_t v = vec_load(*p);
+    *p += VEC_PIXELS;
+    return v;
+}
+
+static inline vec_t vec_fetch_a8(twin_a8_t **p)
+{
+    vec_t v = vec_a8(*p);
+    *p += VEC_PIXELS;
+    return v;
+}
+
+/* Classify the next VEC_PIXELS mask values as all 0x00, all 0xff or mixed */
+typedef enum { VEC_A8_CLEAR, VEC_A8_SOLID, VEC_A8_MIXED } vec_a8_kind_t;
+
+static inline vec_a8_kind_t vec_a8_kind(const twin_a8_t *p)
+{
+    uint64_t w = 0;
+
+    memcpy(&w, p, VEC_PIXELS);
+    if (!w)
+        return VEC_A8_CLEAR;
+    if (w == UINT64_MAX >> (64 - 8 * VEC_PIXELS))
+        return VEC_A8_SOLID;
+    return VEC_A8_MIXED;
+}
+
+#define vec_src_argb32_init
+#define vec_src_argb32 vec_fetch_argb32(&src.p.argb32)
+#define vec_src_argb32_skip (src.p.argb32 += VEC_PIXELS)
+#define vec_src_argb32_opaque (false)
+#define vec_src_a8_init
+#define vec_src_a8 vec_shl24(vec_fetch_a8(&src.p.a8))
+#define vec_src_a8_skip (src.p.a8 += VEC_PIXELS)
+#define vec_src_a8_opaque (false)
+#define vec_src_c_init const vec_t src_c = vec_splat(src.c);
+#define vec_src_c src_c
+#define vec_src_c_skip ((void) 0)
+#define vec_src_c_opaque ((src.c >> 24) == 0xff)
+
+#define vec_msk_argb32_init
+#define vec_msk_argb32 vec_alpha(vec_fetch_argb32(&msk.p.argb32))
+#define vec_msk_a8_init
+#define vec_msk_a8 vec_spread(vec_fetch_a8(&msk.p.a8))
+#define vec_msk_c_init const vec_t msk_c = vec_alpha(vec_splat(msk.c));
+#define vec_msk_c msk_c
+
+#define VEC_CAT2(a, b) a##b
+#define VEC_CAT3(a, b, c) a##b##c
+
+#define MAKE_VEC_in_over(__src, __msk)                                       \
+    static void VEC_NAME(__src##_in_##__msk##_over_argb32)(                  \
+        twin_pointer_t dst, twin_source_u src, twin_source_u msk, int width) \
+    {                                                                        \
+        VEC_CAT3(vec_src_, __src, _init)                                     \
+        VEC_CAT3(vec_msk_, __msk, _init)                                     \
+        for (; width >= VEC_PIXELS; width -= VEC_PIXELS) {                   \
+            vec_t s = VEC_CAT2(vec_src_, __src);                             \
+            vec_t m = VEC_CAT2(vec_msk_, __msk);                             \
+            vec_store(dst.argb32,                                            \
+                      vec_over(vec_load(dst.argb32), vec_mul(s, m)));        \
+            dst.argb32 += VEC_PIXELS;                                        \
+        }                                                                    \
+        if (width)                                                           \
+            _twin_##__src##_in_##__msk##_over_argb32(dst, src, msk, width);  \
+    }
+
+/*
+ * Glyph and path masks are mostly runs of 0x00 and 0xff: leave the
+ * destination untouched under a clear mask and skip the multiply under a
+ * solid one, storing the source outright when it is opaque.
+ */
+#define MAKE_VEC_in_over_a8(__src)                                           \
+    static void VEC_NAME(__src##_in_a8_over_argb32)(                         \
+        twin_pointer_t dst, twin_source_u src, twin_source_u msk, int width) \
+    {                                                                        \
+        VEC_CAT3(vec_src_, __src, _init)                                     \
+        vec_t s;                                                             \
+        for (; width >= VEC_PIXELS; width -= VEC_PIXELS) {                   \
+            switch (vec_a8_kind(msk.p.a8)) {                                 \
+            case VEC_A8_CLEAR:                                               \
+                VEC_CAT3(vec_src_, __src, _skip);                            \
+                msk.p.a8 += VEC_PIXELS;                                      \
+                break;                                                       \
+            case VEC_A8_SOLID:                                               \
+                s = VEC_CAT2(vec_src_, __src);                               \
+                msk.p.a8 += VEC_PIXELS;                                      \
+                if (!VEC_CAT3(vec_src_, __src, _opaque))                     \
+                    s = vec_over(vec_load(dst.argb32), s);                   \
+                vec_store(dst.argb32, s);                                    \
+                break;                                                       \
+            default:                                                         \
+                s = vec_mul(VEC_CAT2(vec_src_, __src), vec_msk_a8);          \
+                vec_store(dst.argb32, vec_over(vec_load(dst.argb32), s));    \
+                break;                                                       \
+            }                                                                \
+            dst.argb32 += VEC_PIXELS;                                        \
+        }                                                                    \
+        if (width)                                                           \
+            _twin_##__src##_in_a8_over_argb32(dst, src, msk, width);         \
+    }
+
+#define MAKE_VEC_in_source_a8(__src) MAKE_VEC_in_source(__src, a8)
+
+#define MAKE_VEC_in_source(__src, __msk)                                       \
+    static void VEC_NAME(__src##_in_##__msk##_source_argb32)(                  \
+        twin_pointer_t dst, twin_source_u src, twin_source_u msk, int width)   \
+    {                                                                          \
+        VEC_CAT3(vec_src_, __src, _init)                                       \
+        VEC_CAT3(vec_msk_, __msk, _init)                                       \
+        for (; width >= VEC_PIXELS; width -= VEC_PIXELS) {                     \
+            vec_t s = VEC_CAT2(vec_src_, __src);                               \
+            vec_t m = VEC_CAT2(vec_msk_, __msk);                               \
+            vec_store(dst.argb32, vec_mul(s, m));                              \
+            dst.argb32 += VEC_PIXELS;                                          \
+        }                                                                      \
+        if (width)                                                             \
+            _twin_##__src##_in_##__msk##_source_argb32(dst, src, msk, width);  \
+    }
+
+#define MAKE_VEC_over(__src)                                                \
+    static void VEC_NAME(__src##_over_argb32)(twin_pointer_t dst,           \
+                                              twin_source_u src, int width) \
+    {                                                                       \
+        VEC_CAT3(vec_src_, __src, _init)                                    \
+        for (; width >= VEC_PIXELS; width -= VEC_PIXELS) {                  \
+            vec_t s = VEC_CAT2(vec_src_, __src);                            \
+            vec_store(dst.argb32, vec_over(vec_load(dst.argb32), s));       \
+            dst.argb32 += VEC_PIXELS;                                       \
+        }                                                                   \
+        if (width)                                                          \
+            _twin_##__src##_over_argb32(dst, src, width);                   \
+    }
+
+#define MAKE_VEC_source(__src)                                                \
+    static void VEC_NAME(__src##_source_argb32)(twin_pointer_t dst,           \
+                                                twin_source_u src, int width) \
+    {                                                                         \
+        VEC_CAT3(vec_src_, __src, _init)                                      \
+        for (; width >= VEC_PIXELS; width -= VEC_PIXELS) {                    \
+            vec_store(dst.argb32, VEC_CAT2(vec_src_, __src));                 \
+            dst.argb32 += VEC_PIXELS;                                         \
+        }                                                                     \
+        if (width)                                                            \
+            _twin_##__src##_source_argb32(dst, src, width);                   \
+    }
+
+/* clang-format off */
+#define MAKE_VEC_in_op_msks(op, src)    \
+    MAKE_VEC_in_##op(src, argb32)       \
+    MAKE_VEC_in_##op##_a8(src)          \
+    MAKE_VEC_in_##op(src, c)
+
+#define MAKE_VEC_in_op_srcs_msks(op)    \
+    MAKE_VEC_in_op_msks(op, argb32)     \
+    MAKE_VEC_in_op_msks(op, a8)         \
+    MAKE_VEC_in_op_msks(op, c)
+
+#define MAKE_VEC_op_srcs(op)            \
+    MAKE_VEC_##op(argb32)               \
+    MAKE_VEC_##op(a8)                   \
+    MAKE_VEC_##op(c)
+
+MAKE_VEC_in_op_srcs_msks(over)
+MAKE_VEC_in_op_srcs_msks(source)
+MAKE_VEC_op_srcs(over)
+MAKE_VEC_op_srcs(source)
+
+#define VEC_OPS_MSKS(src, op)                                   \
+    {                                                           \
+        [TWIN_A8] = VEC_NAME(src##_in_a8_##op##_argb32),        \
+        [TWIN_ARGB32] = VEC_NAME(src##_in_argb32_##op##_argb32),\
+        [3] = VEC_NAME(src##_in_c_##op##_argb32),               \
+    }
+
+#define VEC_OPS_SRCS_MSKS(op)                                   \
+    {                                                           \
+        [TWIN_A8] = VEC_OPS_MSKS(a8, op),                       \
+        [TWIN_ARGB32] = VEC_OPS_MSKS(argb32, op),               \
+        [3] = VEC_OPS_MSKS(c, op),                              \
+    }
+
+#define VEC_OPS_SRCS(op)                                        \
+    {                                                           \
+        [TWIN_A8] = VEC_NAME(a8_##op##_argb32),                 \
+        [TWIN_ARGB32] = VEC_NAME(argb32_##op##_argb32),         \
+        [3] = VEC_NAME(c_##op##_argb32),                        \
+    }
+
+const twin_simd_ops_t VEC_NAME(ops) = {
+    .comp2 = {
+        [TWIN_OVER] = VEC_OPS_SRCS(over),
+        [TWIN_SOURCE] = VEC_OPS_SRCS(source),
+    },
+    .comp3 = {
+        [TWIN_OVER] = VEC_OPS_SRCS_MSKS(over),
+        [TWIN_SOURCE] = VEC_OPS_SRCS_MSKS(source),
+    },
+    .cover = VEC_NAME(cover),
+};
+/* clang-format on */
@@ -119,6 +119,56 @@ static inline twin_a8_t argb32_to_a8(twin_argb32_t v)
     (void) msk
 #define msk_a8 (*msk.p.a8++)
 
+#define dst_argb32_skip(n) (dst.argb32 += (n))
+#define dst_rgb16_skip(n) (dst.rgb16 += (n))
+#define dst_a8_skip(n) (dst.a8 += (n))
+
+#define src_argb32_skip(n) (src.p.argb32 += (n))
+#define src_rgb16_skip(n) (src.p.rgb16 += (n))
+#define src_a8_skip(n) (src.p.a8 += (n))
+#define src_c_skip(n) ((void) (n))
+
+#define src_argb32_opaque (false)
+#define src_rgb16_opaque (true)
+#define src_a8_opaque (false)
+#define src_c_opaque ((src.c >> 24) == 0xff)
+
+/*
+ * Mask runs shorter than this are cheaper to composite pixel by pixel than
+ * to hand off to another kernel.
+ */
+#define A8_RUN_MIN 8
+
+/*
+ * Return the length of the run of 0x00 or 0xff values starting at 'msk',
+ * comparing a machine word at a time once aligned, or 0 when the first
+ * value is neither.
+ */
+static inline int a8_run(const twin_a8_t *msk, int width)
+{
+    const twin_a8_t v = *msk;
+    uintptr_t pattern, w;
+    int n = 1;
+
+    if (v != 0x00 && v != 0xff)
+        return 0;
+    while (n < width && ((uintptr_t) (msk + n) & (sizeof(uintptr_t) - 1))) {
+        if (msk[n] != v)
+            return n;
+        n++;
+    }
+    pattern = v ? ~(uintptr_t) 0 : 0;
+    while (n + (int) sizeof(uintptr_t) <= width) {
+        memcpy(&w, msk + n, sizeof(w));
+        if (w != pattern)
+            break;
+        n += sizeof(uintptr_t);
+    }
+    while (n < width && msk[n] == v)
+        n++;
+    return n;
+}
+
 #define CAT2(a, b) a##b
 #define CAT3(a, b, c) a##b##c
 #define CAT4(a, b, c, d) a##b##c##d
@@ -145,6 +195,47 @@ static inline twin_a8_t argb32_to_a8(twin_argb32_t v)
         }                                                                    \
     }
 
+/*
+ * A8 masks from paths and glyphs are mostly long runs of 0x00 and 0xff:
+ * skip the transparent runs and hand the opaque ones to the unmasked kernel.
+ */
+#define MAKE_TWIN_in_over_a8(__dst, __src)                                   \
+    void _twin_in_op_name(__src, _over_, a8, __dst)(                         \
+        twin_pointer_t dst, twin_source_u src, twin_source_u msk, int width) \
+    {                                                                        \
+        twin_argb32_t dst32;                                                 \
+        twin_argb32_t src32;                                                 \
+        twin_a8_t msk8;                                                      \
+        int run;                                                             \
+        while (width) {                                                      \
+            run = a8_run(msk.p.a8, width);                                   \
+            if (run >= A8_RUN_MIN) {                                         \
+                if (*msk.p.a8 && CAT3(src_, __src, _opaque))                 \
+                    _twin_op_name(__src, _source_, __dst)(dst, src, run);    \
+                else if (*msk.p.a8)                                          \
+                    _twin_op_name(__src, _over_, __dst)(dst, src, run);      \
+                CAT3(dst_, __dst, _skip)(run);                               \
+                CAT3(src_, __src, _skip)(run);                               \
+                msk.p.a8 += run;                                             \
+                width -= run;                                                \
+                continue;                                                    \
+            }                                                                \
+            if (!run)                                                        \
+                run = 1;                                                     \
+            width -= run;                                                    \
+            while (run--) {                                                  \
+                dst32 = CAT3(dst_, __dst, _get);                             \
+                src32 = CAT2(src_, __src);                                   \
+                msk8 = msk_a8;                                               \
+                dst32 = in_over(dst32, src32, msk8);                         \
+                CAT3(dst_, __dst, _set)(dst32);                              \
+            }                                                                \
+        }                                                                    \
+    }
+
+#define MAKE_TWIN_in_source_a8(__dst, __src) \
+    MAKE_TWIN_in_source(__dst, __src, a8)
+
 #define MAKE_TWIN_in_source(__dst, __src, __msk)                             \
     void _twin_in_op_name(__src, _source_, __msk, __dst)(                    \
         twin_pointer_t dst, twin_source_u src, twin_source_u msk, int width) \
@@ -164,7 +255,7 @@ static inline twin_a8_t argb32_to_a8(twin_argb32_t v)
 #define MAKE_TWIN_in_op_msks(op, dst, src)        \
     CAT2(MAKE_TWIN_in_, op)(dst, src, argb32)     \
     CAT2(MAKE_TWIN_in_, op)(dst, src, rgb16)      \
-    CAT2(MAKE_TWIN_in_, op)(dst, src, a8)         \
+    CAT3(MAKE_TWIN_in_, op, _a8)(dst, src)        \
     CAT2(MAKE_TWIN_in_, op)(dst, src, c)
 /* clang-format on */
 
@@ -221,3 +312,22 @@ MAKE_TWIN_in_op_dsts_srcs_msks(over) MAKE_TWIN_in_op_dsts_srcs_msks(source)
     MAKE_TWIN_op_dsts_srcs(source);
 
 /* clang-format on */
+
+int32_t _twin_cover_span(twin_a8_t *dst,
+                         int32_t *cells,
+                         int width,
+                         int32_t sum)
+{
+    while (width--) {
+        int32_t a;
+        twin_a16_t t;
+
+        sum += *cells;
+        *cells++ = 0;
+        a = sum < 0 ? -sum : sum;
+        a = (a - (a >> 8) + 0x80) >> 8;
+        t = *dst + (a > 0xff ? 0xff : a);
+        *dst++ = twin_sat(t);
+    }
+    return sum;
+}
@@ -0,0 +1,189 @@
+/*
+ * Twin - A Tiny Window System
+ * Copyright (c) 2024 National Cheng Kung University, Taiwan
+ * All rights reserved.
+ */
+
+#include "twin_private.h"
+
+/*
+ * Two rectangles are merged when their bounding box adds few pixels
+ * beyond what they cover on their own: less than a quarter of the box,
+ * or less than REGION_SLACK pixels outright.  Drawing a few extra pixels
+ * is cheaper than tracking many small rectangles.
+ */
+#define REGION_SLACK 1024
+
+static int64_t _twin_rect_area(const twin_rect_t *r)
+{
+    return (int64_t) (r->right - r->left) * (r->bottom - r->top);
+}
+
+static bool _twin_rect_contains(const twin_rect_t *a, const twin_rect_t *b)
+{
+    return a->left <= b->left && b->right <= a->right && a->top <= b->top &&
+           b->bottom <= a->bottom;
+}
+
+static bool _twin_rect_overlaps(const twin_rect_t *a, const twin_rect_t *b)
+{
+    return a->left < b->right && b->left < a->right && a->top < b->bottom &&
+           b->top < a->bottom;
+}
+
+static twin_rect_t _twin_rect_union(const twin_rect_t *a, const twin_rect_t *b)
+{
+    twin_rect_t u = *a;
+
+    if (b->left < u.left)
+        u.left = b->left;
+    if (b->top < u.top)
+        u.top = b->top;
+    if (b->right > u.right)
+        u.right = b->right;
+    if (b->bottom > u.bottom)
+        u.bottom = b->bottom;
+    return u;
+}
+
+/* Pixels covered by the bounding box of a and b but by neither of them */
+static int64_t _twin_rect_waste(const twin_rect_t *a, const twin_rect_t *b)
+{
+    twin_rect_t u = _twin_rect_union(a, b);
+    int64_t waste = _twin_rect_area(&u) - _twin_rect_area(a) -
+                    _twin_rect_area(b);
+
+    if (_twin_rect_overlaps(a, b)) {
+        twin_rect_t i = {
+            .left = a->left > b->left ? a->left : b->left,
+            .right = a->right < b->right ? a->right : b->right,
+            .top = a->top > b->top ? a->top : b->top,
+            .bottom = a->bottom < b->bottom ? a->bottom : b->bottom,
+        };
+        waste += _twin_rect_area(&i);
+    }
+    return waste;
+}
+
+static void _twin_region_remove(twin_region_t *region, int i)
+{
+    region->rects[i] = region->rects[--region->nrects];
+}
+
+/* Cut the parts of r not covered by e into out, returning how many */
+static int _twin_rect_subtract(const twin_rect_t *r,
+                               const twin_rect_t *e,
+                               twin_rect_t *out)
+{
+    twin_coord_t top = r->top > e->top ? r->top : e->top;
+    twin_coord_t bottom = r->bottom < e->bottom ? r->bottom : e->bottom;
+    int n = 0;
+
+    if (r->top < e->top)
+        out[n++] = (twin_rect_t){r->left, r->right, r->top, e->top};
+    if (e->bottom < r->bottom)
+        out[n++] = (twin_rect_t){r->left, r->right, e->bottom, r->bottom};
+    if (r->left < e->left)
+        out[n++] = (twin_rect_t){r->left, e->left, top, bottom};
+    if (e->right < r->right)
+        out[n++] = (twin_rect_t){e->right, r->right, top, bottom};
+    return n;
+}
+
+static void _twin_region_add_rect(twin_region_t *region, twin_rect_t r)
+{
+    twin_rect_t pieces[TWIN_REGION_RECTS], cut[TWIN_REGION_RECTS + 3];
+    int i, j, n, m, best;
+
+restart:
+    for (i = 0; i < region->nrects; i++) {
+        const twin_rect_t *e = &region->rects[i];
+        twin_rect_t u;
+        int64_t waste;
+
+        if (_twin_rect_contains(e, &r))
+            return;
+        u = _twin_rect_union(e, &r);
+        waste = _twin_rect_waste(e, &r);
+        if (waste < REGION_SLACK || waste * 4 <= _twin_rect_area(&u)) {
+            r = u;
+            _twin_region_remove(region, i);
+            goto restart;
+        }
+    }
+
+    /* Keep what r overlaps and add only the parts of r around it */
+    pieces[0] = r;
+    n = 1;
+    for (i = 0; i < region->nrects; i++) {
+        m = 0;
+        for (j = 0; j < n; j++) {
+            if (_twin_rect_overlaps(&pieces[j], &region->rects[i]))
+                m += _twin_rect_subtract(&pieces[j], &region->rects[i],
+                                         cut + m);
+            else
+                cut[m++] = pieces[j];
+            if (m > TWIN_REGION_RECTS - region->nrects)
+                goto fold;
+        }
+        memcpy(pieces, cut, m * sizeof(twin_rect_t));
+        n = m;
+    }
+    for (j = 0; j < n; j++)
+        region->rects[region->nrects++] = pieces[j];
+    return;
+
+fold:
+    /*
+     * Out of room: fold r into the rectangle where that costs the fewest
+     * extra pixels, then swallow anything the result overlaps
+     */
+    best = 0;
+    for (i = 1; i < region->nrects; i++)
+        if (_twin_rect_waste(&region->rects[i], &r) <
+            _twin_rect_waste(&region->rects[best], &r))
+            best = i;
+    r = _twin_rect_union(&region->rects[best], &r);
+    _twin_region_remove(region, best);
+    for (i = 0; i < region->nrects; i++) {
+        if (_twin_rect_overlaps(&region->rects[i], &r)) {
+            r = _twin_rect_union(&region->rects[i], &r);
+            _twin_region_remove(region, i);
+            i = -1;
+        }
+    }
+    region->rects[region->nrects++] = r;
+}
+
+void twin_region_clear(twin_region_t *region)
+{
+    region->nrects = 0;
+}
+
+bool twin_region_empty(const twin_region_t *region)
+{
+    return region->nrects == 0;
+}
+
+void twin_region_add(twin_region_t *region,
+                     twin_coord_t left,
+                     twin_coord_t top,
+                     twin_coord_t right,
+                     twin_coord_t bottom)
+{
+    if (left >= right || top >= bottom)
+        return;
+    _twin_region_add_rect(region, (twin_rect_t){left, right, top, bottom});
+}
+
+twin_rect_t twin_region_extents(const twin_region_t *region)
+{
+    twin_rect_t extents = {0, 0, 0, 0};
+
+    if (region->nrects) {
+        extents = region->rects[0];
+        for (int i = 1; i < region->nrects; i++)
+            extents = _twin_rect_union(&extents, &region->rects[i]);
+    }
+    return extents;
+}
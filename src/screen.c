@@ -22,14 +22,16 @@ twin_screen_t *twin_screen_create(twin_coord_t width,
     screen->bottom = 0;
     screen->width = width;
     screen->height = height;
-    screen->damage.left = screen->damage.right = 0;
-    screen->damage.top = screen->damage.bottom = 0;
+    twin_region_clear(&screen->damage);
     screen->damaged = NULL;
     screen->damaged_closure = NULL;
     screen->disable = 0;
     screen->background = 0;
     screen->put_begin = put_begin;
     screen->put_span = put_span;
+    screen->put_rect = NULL;
+    screen->put_end = NULL;
+    screen->framebuffer.base.v = NULL;
     screen->closure = closure;
 
     screen->button_x = screen->button_y = -1;
@@ -38,11 +40,31 @@ twin_screen_t *twin_screen_create(twin_coord_t width,
 
 void twin_screen_destroy(twin_screen_t *screen)
 {
+    if (screen->events_work)
+        twin_clear_work(screen->events_work);
     while (screen->bottom)
         twin_pixmap_hide(screen->bottom);
+    twin_arena_fini(&screen->arena);
     free(screen);
 }
 
+void twin_screen_set_put_rect(twin_screen_t *screen,
+                              twin_put_rect_t put_rect,
+                              twin_put_end_t put_end)
+{
+    screen->put_rect = put_rect;
+    screen->put_end = put_end;
+}
+
+void twin_screen_set_framebuffer(twin_screen_t *screen,
+                                 const twin_framebuffer_t *framebuffer)
+{
+    if (framebuffer)
+        screen->framebuffer = *framebuffer;
+    else
+        screen->framebuffer.base.v = NULL;
+}
+
 void twin_screen_register_damaged(twin_screen_t *screen,
                                   void (*damaged)(void *),
                                   void *closure)
@@ -54,11 +76,8 @@ void twin_screen_register_damaged(twin_screen_t *screen,
 void twin_screen_enable_update(twin_screen_t *screen)
 {
     if (--screen->disable == 0) {
-        if (screen->damage.left < screen->damage.right &&
-            screen->damage.top < screen->damage.bottom) {
-            if (screen->damaged)
-                (*screen->damaged)(screen->damaged_closure);
-        }
+        if (!twin_region_empty(&screen->damage) && screen->damaged)
+            (*screen->damaged)(screen->damaged_closure);
     }
 }
 
@@ -82,21 +101,7 @@ void twin_screen_damage(twin_screen_t *screen,
     if (bottom > screen->height)
         bottom = screen->height;
 
-    if (screen->damage.left == screen->damage.right) {
-        screen->damage.left = left;
-        screen->damage.right = right;
-        screen->damage.top = top;
-        screen->damage.bottom = bottom;
-    } else {
-        if (left < screen->damage.left)
-            screen->damage.left = left;
-        if (top < screen->damage.top)
-            screen->damage.top = top;
-        if (screen->damage.right < right)
-            screen->damage.right = right;
-        if (screen->damage.bottom < bottom)
-            screen->damage.bottom = bottom;
-    }
+    twin_region_add(&screen->damage, left, top, right, bottom);
     if (screen->damaged && !screen->disable)
         (*screen->damaged)(screen->damaged_closure);
 }
@@ -112,8 +117,7 @@ void twin_screen_resize(twin_screen_t *screen,
 
 bool twin_screen_damaged(twin_screen_t *screen)
 {
-    return (screen->damage.left < screen->damage.right &&
-            screen->damage.top < screen->damage.bottom);
+    return !twin_region_empty(&screen->damage);
 }
 
 static void twin_screen_span_pixmap(twin_screen_t maybe_unused *screen,
@@ -151,77 +155,271 @@ static void twin_screen_span_pixmap(twin_screen_t maybe_unused *screen,
         op32(dst, src, p_right - p_left);
 }
 
-void twin_screen_update(twin_screen_t *screen)
+static void twin_screen_span_background(twin_screen_t *screen,
+                                        twin_argb32_t *span,
+                                        twin_coord_t y,
+                                        twin_coord_t left,
+                                        twin_coord_t right)
 {
-    twin_coord_t left = screen->damage.left;
-    twin_coord_t top = screen->damage.top;
-    twin_coord_t right = screen->damage.right;
-    twin_coord_t bottom = screen->damage.bottom;
-    twin_src_op pop16, pop32, bop32;
+    twin_pointer_t dst;
+    twin_source_u src;
+    twin_coord_t p_left;
+    twin_coord_t m_left;
+    twin_coord_t p_this;
+    twin_coord_t p_width;
+    twin_coord_t p_y;
+
+    if (!screen->background) {
+        memset(span, 0xff, (right - left) * sizeof(twin_argb32_t));
+        return;
+    }
 
-    pop16 = _twin_rgb16_source_argb32;
-    pop32 = _twin_argb32_over_argb32;
-    bop32 = _twin_argb32_source_argb32;
+    p_width = screen->background->width;
+    p_y = y % screen->background->height;
+    for (p_left = left; p_left < right; p_left += p_this) {
+        dst.argb32 = span + (p_left - left);
+        m_left = p_left % p_width;
+        p_this = p_width - m_left;
+        if (p_left + p_this > right)
+            p_this = right - p_left;
+        src.p = twin_pixmap_pointer(screen->background, m_left, p_y);
+        _twin_vec_argb32_source_argb32(dst, src, p_this);
+    }
+}
 
-    if (right > screen->width)
-        right = screen->width;
-    if (bottom > screen->height)
-        bottom = screen->height;
+/* Narrow left..right to where p is known opaque on row y, if anywhere */
+static bool twin_screen_opaque_span(const twin_pixmap_t *p,
+                                    twin_coord_t y,
+                                    twin_coord_t *left,
+                                    twin_coord_t *right)
+{
+    twin_coord_t o_left = p->x + p->opaque.left;
+    twin_coord_t o_right = p->x + p->opaque.right;
+
+    if (y < p->y + p->opaque.top || p->y + p->opaque.bottom <= y)
+        return false;
+    if (o_left < *left)
+        o_left = *left;
+    if (o_right > *right)
+        o_right = *right;
+    if (o_left >= o_right)
+        return false;
+    *left = o_left;
+    *right = o_right;
+    return true;
+}
+
+/*
+ * Composite row y between left and right from the bottom of the stack up
+ * to and including 'from'. Walking down from 'from', the first pixmap
+ * opaque over part of the segment is copied there and nothing beneath it
+ * is drawn; the pieces on either side of it continue further down.
+ */
+static void twin_screen_span_segment(twin_screen_t *screen,
+                                     twin_argb32_t *span,
+                                     twin_pixmap_t *from,
+                                     twin_coord_t y,
+                                     twin_coord_t left,
+                                     twin_coord_t right)
+{
+    twin_src_op pop16 = _twin_rgb16_source_argb32;
+    twin_src_op pop32 = _twin_vec_argb32_over_argb32;
+    twin_src_op bop32 = _twin_vec_argb32_source_argb32;
+    twin_pixmap_t *p, *stop = from ? from->up : NULL;
+    twin_coord_t c_left = left, c_right = right;
+
+    for (p = from; p; p = p->down)
+        if (twin_screen_opaque_span(p, y, &c_left, &c_right))
+            break;
+
+    if (p) {
+        if (left < c_left) {
+            twin_screen_span_segment(screen, span, p->down, y, left, c_left);
+            twin_screen_span_pixmap(screen, span, p, y, left, c_left, pop16,
+                                    pop32);
+        }
+        if (c_right < right) {
+            twin_argb32_t *r_span = span + (c_right - left);
+
+            twin_screen_span_segment(screen, r_span, p->down, y, c_right,
+                                     right);
+            twin_screen_span_pixmap(screen, r_span, p, y, c_right, right,
+                                    pop16, pop32);
+        }
+        twin_screen_span_pixmap(screen, span + (c_left - left), p, y, c_left,
+                                c_right, pop16, bop32);
+        p = p->up;
+    } else {
+        twin_screen_span_background(screen, span, y, left, right);
+        p = from ? screen->bottom : NULL;
+    }
+
+    for (; p != stop; p = p->up)
+        twin_screen_span_pixmap(screen, span, p, y, left, right, pop16, pop32);
+}
 
-    if (!screen->disable && left < right && top < bottom) {
-        twin_argb32_t *span;
-        twin_pixmap_t *p;
-        twin_coord_t y;
-        twin_coord_t width = right - left;
-
-        screen->damage.left = screen->damage.right = 0;
-        screen->damage.top = screen->damage.bottom = 0;
-        /* FIXME: what is the maximum number of lines? */
-        span = malloc(width * sizeof(twin_argb32_t));
-        if (!span)
+static bool twin_screen_span_hits(const twin_pixmap_t *p,
+                                  twin_coord_t y,
+                                  twin_coord_t left,
+                                  twin_coord_t right)
+{
+    return p->y <= y && y < p->y + p->height && p->x < right &&
+           left < p->x + p->width;
+}
+
+/*
+ * When a single pixmap decides every pixel of row y between left and
+ * right, being opaque there with nothing above it, copy that row straight
+ * to dst without reading dst at all.
+ */
+static bool twin_screen_span_direct(twin_screen_t *screen,
+                                    twin_argb32_t *dst,
+                                    twin_coord_t y,
+                                    twin_coord_t left,
+                                    twin_coord_t right)
+{
+    twin_coord_t o_left = left, o_right = right;
+    twin_pixmap_t *p;
+
+#if defined(CONFIG_CURSOR)
+    if (screen->cursor && twin_screen_span_hits(screen->cursor, y, left, right))
+        return false;
+#endif
+    for (p = screen->top; p; p = p->down) {
+        if (twin_screen_opaque_span(p, y, &o_left, &o_right))
+            break;
+        if (twin_screen_span_hits(p, y, left, right))
+            return false;
+    }
+    if (!p || o_left != left || o_right != right)
+        return false;
+
+    twin_screen_span_pixmap(screen, dst, p, y, left, right,
+                            _twin_rgb16_source_argb32,
+                            _twin_vec_argb32_source_argb32);
+    return true;
+}
+
+static void twin_screen_update_rect(twin_screen_t *screen,
+                                    twin_argb32_t *span,
+                                    twin_coord_t left,
+                                    twin_coord_t top,
+                                    twin_coord_t right,
+                                    twin_coord_t bottom)
+{
+    twin_framebuffer_t *fb = &screen->framebuffer;
+    twin_pointer_t rect = {.v = NULL};
+    twin_format_t format = TWIN_ARGB32;
+    twin_coord_t stride = 0;
+    bool readable = true, put_rect = false;
+
+    if (fb->base.v) {
+        if (right > fb->width)
+            right = fb->width;
+        if (bottom > fb->height)
+            bottom = fb->height;
+        if (left >= right || top >= bottom)
             return;
+        rect.b = fb->base.b + top * fb->stride +
+                 left * twin_bytes_per_pixel(fb->format);
+        stride = fb->stride;
+        format = fb->format;
+        readable = fb->readable;
+    } else if (screen->put_rect) {
+        rect.argb32 = (*screen->put_rect)(left, top, right, bottom, &stride,
+                                          screen->closure);
+        if (rect.v)
+            put_rect = true;
+    }
+    if (!rect.v && !screen->put_span)
+        return;
+    if (!put_rect && screen->put_begin)
+        (*screen->put_begin)(left, top, right, bottom, screen->closure);
+
+    for (twin_coord_t y = top; y < bottom; y++) {
+        twin_pointer_t out = {.v = NULL};
+        twin_argb32_t *row = span;
+        twin_source_u src;
+
+        if (rect.v)
+            out.b = rect.b + (y - top) * stride;
+        if (rect.v && format == TWIN_ARGB32) {
+            /* compose in place, or skip composing altogether */
+            if (readable)
+                row = out.argb32;
+            else if (twin_screen_span_direct(screen, out.argb32, y, left,
+                                              right))
+                continue;
+        }
 
-        if (screen->put_begin)
-            (*screen->put_begin)(left, top, right, bottom, screen->closure);
-        for (y = top; y < bottom; y++) {
-            if (screen->background) {
-                twin_pointer_t dst;
-                twin_source_u src;
-                twin_coord_t p_left;
-                twin_coord_t m_left;
-                twin_coord_t p_this;
-                twin_coord_t p_width = screen->background->width;
-                twin_coord_t p_y = y % screen->background->height;
-
-                for (p_left = left; p_left < right; p_left += p_this) {
-                    dst.argb32 = span + (p_left - left);
-                    m_left = p_left % p_width;
-                    p_this = p_width - m_left;
-                    if (p_left + p_this > right)
-                        p_this = right - p_left;
-                    src.p =
-                        twin_pixmap_pointer(screen->background, m_left, p_y);
-                    bop32(dst, src, p_this);
-                }
-            } else
-                memset(span, 0xff, width * sizeof(twin_argb32_t));
-
-            for (p = screen->bottom; p; p = p->up)
-                twin_screen_span_pixmap(screen, span, p, y, left, right, pop16,
-                                        pop32);
+        twin_screen_span_segment(screen, row, screen->top, y, left, right);
 
 #if defined(CONFIG_CURSOR)
-            if (screen->cursor)
-                twin_screen_span_pixmap(screen, span, screen->cursor, y, left,
-                                        right, pop16, pop32);
+        if (screen->cursor)
+            twin_screen_span_pixmap(screen, row, screen->cursor, y, left,
+                                    right, _twin_rgb16_source_argb32,
+                                    _twin_vec_argb32_over_argb32);
 #endif
 
+        if (!rect.v) {
             (*screen->put_span)(left, y, right, span, screen->closure);
+        } else if (row == span) {
+            /* write the finished row out in one pass */
+            src.p.argb32 = span;
+            if (format == TWIN_RGB16)
+                _twin_argb32_source_rgb16(out, src, right - left);
+            else
+                memcpy(out.argb32, span, (right - left) * sizeof(*span));
         }
-        free(span);
     }
 }
 
+void twin_screen_update(twin_screen_t *screen)
+{
+    twin_region_t damage = screen->damage;
+    twin_argb32_t *span;
+    twin_coord_t width = 0;
+
+    /* drawing done before this update is finished with its scratch */
+    twin_arena_reset(&screen->arena);
+    if (screen->disable || twin_region_empty(&damage))
+        return;
+    twin_region_clear(&screen->damage);
+
+    /* the screen may have shrunk since the damage was recorded */
+    for (int i = 0; i < damage.nrects; i++) {
+        twin_rect_t *r = &damage.rects[i];
+
+        if (r->right > screen->width)
+            r->right = screen->width;
+        if (r->bottom > screen->height)
+            r->bottom = screen->height;
+        if (r->right - r->left > width)
+            width = r->right - r->left;
+    }
+    if (width <= 0)
+        return;
+
+    /*
+     * One span serves every rectangle drawn through put_span. It comes
+     * from the arena just reset, which keeps its memory across updates
+     */
+    span = twin_arena_alloc(&screen->arena, width * sizeof(twin_argb32_t));
+    if (!span)
+        return;
+
+    for (int i = 0; i < damage.nrects; i++) {
+        const twin_rect_t *r = &damage.rects[i];
+
+        if (r->left < r->right && r->top < r->bottom)
+            twin_screen_update_rect(screen, span, r->left, r->top, r->right,
+                                    r->bottom);
+    }
+
+    if (screen->put_end)
+        (*screen->put_end)(screen->closure);
+}
+
 void twin_screen_set_active(twin_screen_t *screen, twin_pixmap_t *pixmap)
 {
     twin_event_t ev;
@@ -395,3 +593,54 @@ bool twin_screen_dispatch(twin_screen_t *screen, twin_event_t *event)
         return twin_pixmap_dispatch(pixmap, event);
     return false;
 }
+
+static void _twin_screen_flush_events(twin_screen_t *screen)
+{
+    twin_event_t events[TWIN_SCREEN_EVENTS];
+    twin_count_t n = screen->nevents;
+
+    /* handlers may queue more events, which start a new batch */
+    memcpy(events, screen->events, n * sizeof(twin_event_t));
+    screen->nevents = 0;
+    for (twin_count_t i = 0; i < n; i++)
+        twin_screen_dispatch(screen, &events[i]);
+}
+
+static bool _twin_screen_events_work(void *closure)
+{
+    twin_screen_t *screen = closure;
+
+    screen->events_work = NULL;
+    _twin_screen_flush_events(screen);
+    return false;
+}
+
+/*
+ * Queue an event for dispatch before the next layout and paint. A motion
+ * replaces a motion queued right before it, so a burst of pointer samples
+ * costs a single dispatch; buttons and keys break the run and keep their
+ * place in line.
+ */
+void twin_screen_queue_event(twin_screen_t *screen, const twin_event_t *event)
+{
+    if (screen->nevents && event->kind == TwinEventMotion) {
+        twin_event_t *last = &screen->events[screen->nevents - 1];
+
+        if (last->kind == TwinEventMotion &&
+            last->u.pointer.button == event->u.pointer.button) {
+            *last = *event;
+            return;
+        }
+    }
+
+    if (screen->nevents == TWIN_SCREEN_EVENTS)
+        _twin_screen_flush_events(screen);
+    screen->events[screen->nevents++] = *event;
+
+    if (!screen->events_work) {
+        screen->events_work =
+            twin_set_work(_twin_screen_events_work, TWIN_WORK_EVENT, screen);
+        if (!screen->events_work)
+            _twin_screen_flush_events(screen);
+    }
+}
@@ -5,91 +5,180 @@
  */
 
 #include <stdlib.h>
-#include <sys/time.h>
 #include <time.h>
 
 #include "twin_private.h"
 
-#define twin_time_compare(a, op, b) (((a) - (b)) op 0)
+/*
+ * Pending timeouts live in a binary min-heap ordered by expiry, so arming
+ * and clearing one costs O(log n) however many are pending. Expiry times
+ * are kept in microseconds on the monotonic clock: wall clock steps can
+ * neither fire timeouts early nor stall them, and rounding to milliseconds
+ * only happens at the API boundary.
+ */
+
+static int64_t _twin_now_us(void)
+{
+    struct timespec ts;
 
-static twin_time_t twin_now(void)
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static twin_timeout_t **heap;
+static int heap_len, heap_size;
+
+/* Earlier expiry first; ties go to the timeout armed first */
+static bool _twin_timeout_before(const twin_timeout_t *a,
+                                 const twin_timeout_t *b)
 {
-    struct timeval tv;
-    gettimeofday(&tv, NULL);
-    return tv.tv_sec * 1000 + tv.tv_usec / 1000;
+    if (a->time != b->time)
+        return a->time < b->time;
+    return (int32_t) (a->serial - b->serial) < 0;
+}
+
+static void _twin_heap_set(int i, twin_timeout_t *timeout)
+{
+    heap[i] = timeout;
+    timeout->index = i;
+}
+
+static void _twin_heap_up(int i)
+{
+    twin_timeout_t *timeout = heap[i];
+
+    while (i > 0) {
+        int parent = (i - 1) / 2;
+
+        if (!_twin_timeout_before(timeout, heap[parent]))
+            break;
+        _twin_heap_set(i, heap[parent]);
+        i = parent;
+    }
+    _twin_heap_set(i, timeout);
 }
 
-static twin_queue_t *head;
-static twin_time_t start;
+static void _twin_heap_down(int i)
+{
+    twin_timeout_t *timeout = heap[i];
+
+    for (;;) {
+        int child = 2 * i + 1;
+
+        if (child >= heap_len)
+            break;
+        if (child + 1 < heap_len &&
+            _twin_timeout_before(heap[child + 1], heap[child]))
+            child++;
+        if (!_twin_timeout_before(heap[child], timeout))
+            break;
+        _twin_heap_set(i, heap[child]);
+        i = child;
+    }
+    _twin_heap_set(i, timeout);
+}
 
-static twin_order_t _twin_timeout_order(twin_queue_t *a, twin_queue_t *b)
+static bool _twin_heap_push(twin_timeout_t *timeout)
 {
-    const twin_timeout_t *at = (twin_timeout_t *) a;
-    const twin_timeout_t *bt = (twin_timeout_t *) b;
-
-    if (twin_time_compare(at->time, <, bt->time))
-        return TWIN_AFTER;
-    if (twin_time_compare(at->time, >, bt->time))
-        return TWIN_BEFORE;
-    return TWIN_AT;
+    if (heap_len == heap_size) {
+        int size = heap_size ? heap_size * 2 : 16;
+        twin_timeout_t **h = realloc(heap, size * sizeof(*h));
+
+        if (!h)
+            return false;
+        heap = h;
+        heap_size = size;
+    }
+    _twin_heap_set(heap_len++, timeout);
+    _twin_heap_up(timeout->index);
+    return true;
 }
 
-static void _twin_queue_timeout(twin_timeout_t *timeout, twin_time_t time)
+static void _twin_heap_remove(twin_timeout_t *timeout)
 {
-    timeout->time = time;
-    _twin_queue_remove(&head, &timeout->queue);
-    _twin_queue_insert(&head, _twin_timeout_order, &timeout->queue);
+    int i = timeout->index;
+
+    timeout->index = -1;
+    if (--heap_len == i)
+        return;
+    _twin_heap_set(i, heap[heap_len]);
+    if (i > 0 && _twin_timeout_before(heap[i], heap[(i - 1) / 2]))
+        _twin_heap_up(i);
+    else
+        _twin_heap_down(i);
 }
 
 void _twin_run_timeout(void)
 {
-    twin_time_t now = twin_now();
+    int64_t now = _twin_now_us();
     twin_timeout_t *timeout;
     twin_time_t delay;
 
-    twin_timeout_t *first = (twin_timeout_t *) _twin_queue_set_order(&head);
-    for (timeout = first; timeout && twin_time_compare(now, >=, timeout->time);
-         timeout = (twin_timeout_t *) timeout->queue.order) {
-        delay = (*timeout->proc)(now, timeout->closure);
-        if (delay >= 0) {
-            timeout->time = twin_now() + delay;
-            _twin_queue_reorder(&head, _twin_timeout_order, &timeout->queue);
-        } else
-            _twin_queue_delete(&head, &timeout->queue);
+    while (heap_len && heap[0]->time <= now) {
+        timeout = heap[0];
+        _twin_heap_remove(timeout);
+
+        timeout->running = true;
+        delay = (*timeout->proc)((twin_time_t) (now / 1000), timeout->closure);
+        timeout->running = false;
+
+        if (delay < 0 || timeout->cleared) {
+            free(timeout);
+            continue;
+        }
+        /* never before the next pass, so a zero delay cannot spin here */
+        timeout->time = _twin_now_us() + (int64_t) delay * 1000;
+        if (timeout->time <= now)
+            timeout->time = now + 1;
+        if (!_twin_heap_push(timeout))
+            free(timeout);
     }
-    _twin_queue_review_order(&first->queue);
 }
 
 twin_timeout_t *twin_set_timeout(twin_timeout_proc_t timeout_proc,
                                  twin_time_t delay,
                                  void *closure)
 {
+    static uint32_t serial;
     twin_timeout_t *timeout = malloc(sizeof(twin_timeout_t));
     if (!timeout)
         return NULL;
 
-    if (!start)
-        start = twin_now();
     timeout->delay = delay;
     timeout->proc = timeout_proc;
     timeout->closure = closure;
-    _twin_queue_timeout(timeout, twin_now() + delay);
+    timeout->time = _twin_now_us() + (int64_t) delay * 1000;
+    timeout->serial = serial++;
+    timeout->running = false;
+    timeout->cleared = false;
+    if (!_twin_heap_push(timeout)) {
+        free(timeout);
+        return NULL;
+    }
     return timeout;
 }
 
 void twin_clear_timeout(twin_timeout_t *timeout)
 {
-    _twin_queue_delete(&head, &timeout->queue);
+    /* a timeout cleared from its own callback is freed once that returns */
+    if (timeout->running) {
+        timeout->cleared = true;
+        return;
+    }
+    if (timeout->index >= 0)
+        _twin_heap_remove(timeout);
+    free(timeout);
 }
 
 twin_time_t _twin_timeout_delay(void)
 {
-    if (head) {
-        const twin_timeout_t *thead = (twin_timeout_t *) head;
-        twin_time_t now = twin_now();
-        if (twin_time_compare(now, >=, thead->time))
+    if (heap_len) {
+        int64_t delay = heap[0]->time - _twin_now_us();
+
+        if (delay <= 0)
             return 0;
-        return thead->time - now;
+        /* round up so the wait never ends just short of the expiry */
+        return (twin_time_t) ((delay + 999) / 1000);
     }
     return -1;
 }
@@ -74,12 +74,15 @@ twin_window_t *twin_window_create(twin_screen_t *screen,
         twin_shadow_visible(window->shadow_pixmap, window);
     } else
         window->shadow_pixmap = NULL;
-    window->damage = window->client;
+    twin_region_clear(&window->damage);
+    twin_region_add(&window->damage, window->client.left, window->client.top,
+                    window->client.right, window->client.bottom);
     window->client_grab = false;
     window->want_focus = false;
     window->draw_queued = false;
     window->client_data = 0;
     window->name = 0;
+    window->name_layout = NULL;
 
     window->draw = 0;
     window->event = 0;
@@ -92,6 +95,7 @@ void twin_window_destroy(twin_window_t *window)
     twin_window_hide(window);
     twin_pixmap_destroy(window->pixmap);
     free(window->name);
+    twin_text_layout_destroy(window->name_layout);
     free(window);
     if (window->shadow_pixmap)
         twin_pixmap_destroy(window->shadow_pixmap);
@@ -209,7 +213,7 @@ void twin_window_set_name(twin_window_t *window, const char *name)
 static void twin_window_frame(twin_window_t *window)
 {
     twin_fixed_t bw = twin_int_to_fixed(TWIN_TITLE_BW);
-    twin_path_t *path;
+    twin_path_t *path = NULL;
     twin_fixed_t bw_2 = bw / 2;
     twin_pixmap_t *pixmap = window->pixmap;
     twin_fixed_t w_top = bw_2;
@@ -244,7 +248,14 @@ static void twin_window_frame(twin_window_t *window)
 
     if (window->shadow)
         twin_shadow_visible(window->shadow_pixmap, window);
-    path = twin_path_create();
+    /*
+     * Only a shown window's screen updates, and so resets its scratch;
+     * hidden windows can repaint any number of times before then
+     */
+    if (pixmap->screen)
+        path = twin_path_create_arena(&pixmap->screen->arena);
+    if (!path)
+        path = twin_path_create();
 
 
     /* name */
@@ -253,7 +264,15 @@ static void twin_window_frame(twin_window_t *window)
         name = "twin";
     twin_path_set_font_size(path, name_height);
     twin_path_set_font_style(path, TwinStyleOblique | TwinStyleUnhinted);
-    text_width = twin_width_utf8(path, name);
+    window->name_layout =
+        twin_text_layout_update(window->name_layout, path, name);
+    text_width = 0;
+    if (window->name_layout) {
+        twin_text_metrics_t m;
+
+        twin_text_layout_metrics(window->name_layout, &m);
+        text_width = m.width;
+    }
 
     title_right = (text_x + text_width + bw + icon_size + bw + icon_size + bw +
                    icon_size + t_arc_2);
@@ -291,8 +310,9 @@ static void twin_window_frame(twin_window_t *window)
     twin_pixmap_origin_to_clip(pixmap);
 
     twin_path_move(path, text_x - twin_fixed_floor(menu_x), text_y);
-    twin_path_utf8(path, window->name);
-    twin_paint_path(pixmap, TWIN_FRAME_TEXT, path);
+    if (window->name_layout)
+        twin_paint_text_layout(pixmap, TWIN_FRAME_TEXT, path,
+                               window->name_layout);
 
     twin_pixmap_reset_clip(pixmap);
     twin_pixmap_origin_to_clip(pixmap);
@@ -339,6 +359,7 @@ static void twin_window_frame(twin_window_t *window)
 void twin_window_draw(twin_window_t *window)
 {
     twin_pixmap_t *pixmap = window->pixmap;
+    twin_region_t damage;
 
     switch (window->style) {
     case TwinWindowPlain:
@@ -350,33 +371,32 @@ void twin_window_draw(twin_window_t *window)
     }
 
     /* if no draw function or no damage, return */
-    if (window->draw == NULL || (window->damage.left >= window->damage.right ||
-                                 window->damage.top >= window->damage.bottom))
+    if (window->draw == NULL || twin_region_empty(&window->damage))
         return;
+    damage = window->damage;
 
-    /* clip to damaged area and draw */
-    twin_pixmap_reset_clip(pixmap);
-    twin_pixmap_clip(pixmap, window->damage.left, window->damage.top,
-                     window->damage.right, window->damage.bottom);
     twin_screen_disable_update(window->screen);
-
     if (window->shadow)
         twin_pixmap_disable_update(window->shadow_pixmap);
-    (*window->draw)(window);
 
-    /* damage matching screen area */
-    twin_pixmap_damage(pixmap, window->damage.left, window->damage.top,
-                       window->damage.right, window->damage.bottom);
+    /* draw each damaged rectangle on its own, clipped to it */
+    for (int i = 0; i < damage.nrects; i++) {
+        const twin_rect_t *r = &damage.rects[i];
 
-    if (window->shadow)
-        twin_pixmap_damage(window->shadow_pixmap, window->damage.left,
-                           window->damage.top, window->damage.right,
-                           window->damage.bottom);
+        twin_pixmap_reset_clip(pixmap);
+        twin_pixmap_clip(pixmap, r->left, r->top, r->right, r->bottom);
+        (*window->draw)(window);
+
+        /* damage matching screen area */
+        twin_pixmap_damage(pixmap, r->left, r->top, r->right, r->bottom);
+        if (window->shadow)
+            twin_pixmap_damage(window->shadow_pixmap, r->left, r->top,
+                               r->right, r->bottom);
+    }
     twin_screen_enable_update(window->screen);
 
     /* clear damage and restore clip */
-    window->damage.left = window->damage.right = 0;
-    window->damage.top = window->damage.bottom = 0;
+    twin_region_clear(&window->damage);
     twin_pixmap_reset_clip(pixmap);
     twin_pixmap_clip(pixmap, window->client.left, window->client.top,
                      window->client.right, window->client.bottom);
@@ -400,21 +420,7 @@ void twin_window_damage(twin_window_t *window,
     if (bottom > window->client.bottom)
         bottom = window->client.bottom;
 
-    if (window->damage.left == window->damage.right) {
-        window->damage.left = left;
-        window->damage.right = right;
-        window->damage.top = top;
-        window->damage.bottom = bottom;
-    } else {
-        if (left < window->damage.left)
-            window->damage.left = left;
-        if (top < window->damage.top)
-            window->damage.top = top;
-        if (window->damage.right < right)
-            window->damage.right = right;
-        if (window->damage.bottom < bottom)
-            window->damage.bottom = bottom;
-    }
+    twin_region_add(&window->damage, left, top, right, bottom);
 }
 
 static bool _twin_window_repaint(void *closure)
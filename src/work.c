@@ -38,6 +38,11 @@ void _twin_run_work(void)
     _twin_queue_review_order(&first->queue);
 }
 
+bool _twin_work_pending(void)
+{
+    return head != NULL;
+}
+
 twin_work_t *twin_set_work(twin_work_proc_t work_proc,
                            int priority,
                            void *closure)
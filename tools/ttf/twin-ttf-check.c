@@ -0,0 +1,182 @@
+/*
+ * Twin - A Tiny Window System
+ * Copyright (c) 2024 National Cheng Kung University, Taiwan
+ * All rights reserved.
+ */
+
+#include <ft2build.h>
+#include FT_FREETYPE_H
+#include FT_BBOX_H
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "twin_private.h"
+
+/*
+ * At 64 pixels per em one outline unit is one pixel, so rounding the
+ * outline to that grid is the only difference allowed.
+ */
+#define CHECK_SIZE 64
+#define CHECK_SLOP 1
+
+static int units(FT_Pos v, FT_Face face)
+{
+    return (int) floor(CHECK_SIZE * (double) v / face->units_per_EM + 0.5);
+}
+
+static int near(twin_fixed_t got, int want)
+{
+    return abs(twin_fixed_to_int(twin_fixed_floor(got + TWIN_FIXED_HALF)) -
+               want) <= CHECK_SLOP;
+}
+
+/*
+ * Like twin_path_bounds(), but skipping the lone points the pen moves
+ * leave before and after the glyph
+ */
+static int outline_bounds(const twin_path_t *path, twin_rect_t *rect)
+{
+    twin_sfixed_t left = TWIN_SFIXED_MAX, top = TWIN_SFIXED_MAX;
+    twin_sfixed_t right = TWIN_SFIXED_MIN, bottom = TWIN_SFIXED_MIN;
+    int start = 0;
+
+    for (int s = 0; s <= path->nsublen; s++) {
+        int end = s < path->nsublen ? path->sublen[s] : path->npoints;
+
+        for (int i = start; end - start > 1 && i < end; i++) {
+            const twin_spoint_t *p = &path->points[i];
+
+            if (p->x < left)
+                left = p->x;
+            if (p->x > right)
+                right = p->x;
+            if (p->y < top)
+                top = p->y;
+            if (p->y > bottom)
+                bottom = p->y;
+        }
+        start = end;
+    }
+    if (left > right)
+        return 0;
+    rect->left = twin_sfixed_trunc(left);
+    rect->top = twin_sfixed_trunc(top);
+    rect->right = twin_sfixed_trunc(twin_sfixed_ceil(right));
+    rect->bottom = twin_sfixed_trunc(twin_sfixed_ceil(bottom));
+    return 1;
+}
+
+/*
+ * The TrueType extents, less contours of a single point: they are anchors
+ * rather than ink, and a path drops them too
+ */
+static int ttf_bounds(FT_Outline *outline, FT_BBox *bbox)
+{
+    int start = 0, n = 0;
+
+    for (int i = 0; i < outline->n_contours; i++) {
+        short end = outline->contours[i] - start;
+        FT_Outline contour = {
+            .n_contours = 1,
+            .n_points = end + 1,
+            .points = outline->points + start,
+            .tags = outline->tags + start,
+            .contours = &end,
+        };
+        FT_BBox b;
+
+        start = outline->contours[i] + 1;
+        if (contour.n_points < 2 || FT_Outline_Get_BBox(&contour, &b))
+            continue;
+        if (!n++)
+            *bbox = b;
+        bbox->xMin = b.xMin < bbox->xMin ? b.xMin : bbox->xMin;
+        bbox->yMin = b.yMin < bbox->yMin ? b.yMin : bbox->yMin;
+        bbox->xMax = b.xMax > bbox->xMax ? b.xMax : bbox->xMax;
+        bbox->yMax = b.yMax > bbox->yMax ? b.yMax : bbox->yMax;
+    }
+    return n;
+}
+
+/* Compare one glyph from the twin font against the TrueType outline */
+static int check_glyph(FT_Face face, twin_font_t *font, FT_ULong ucs4)
+{
+    twin_path_t *path = twin_path_create();
+    twin_rect_t bounds;
+    FT_BBox bbox;
+    int ok = 1;
+
+    if (!path)
+        return 0;
+    twin_path_set_font(path, font);
+    twin_path_set_font_size(path, twin_int_to_fixed(CHECK_SIZE));
+    twin_path_set_font_style(path, TwinStyleUnhinted);
+    twin_path_move(path, 0, 0);
+    twin_path_ucs4(path, ucs4);
+
+    if (!near(twin_width_ucs4(path, ucs4),
+              units(face->glyph->linearHoriAdvance, face))) {
+        printf("0x%04lx: advance %d, expected %d\n", ucs4,
+               twin_fixed_to_int(twin_width_ucs4(path, ucs4)),
+               units(face->glyph->linearHoriAdvance, face));
+        ok = 0;
+    }
+
+    if (ttf_bounds(&face->glyph->outline, &bbox) &&
+        outline_bounds(path, &bounds)) {
+        /* twin grows y downwards, TrueType upwards */
+        if (abs(bounds.left - units(bbox.xMin, face)) > CHECK_SLOP ||
+            abs(bounds.right - units(bbox.xMax, face)) > CHECK_SLOP ||
+            abs(bounds.top + units(bbox.yMax, face)) > CHECK_SLOP ||
+            abs(bounds.bottom + units(bbox.yMin, face)) > CHECK_SLOP) {
+            printf("0x%04lx: extents %d,%d-%d,%d, expected %d,%d-%d,%d\n",
+                   ucs4, bounds.left, bounds.top, bounds.right, bounds.bottom,
+                   units(bbox.xMin, face), -units(bbox.yMax, face),
+                   units(bbox.xMax, face), -units(bbox.yMin, face));
+            ok = 0;
+        }
+    }
+    twin_path_destroy(path);
+    return ok;
+}
+
+/*
+ * twin-ttf-check font.ttf font.twf
+ *
+ * Opens a font written by twin-ttf -b and checks each glyph's advance and
+ * extents against the TrueType font it came from.
+ */
+int main(int argc, char **argv)
+{
+    FT_Library ftLibrary;
+    FT_Face face;
+    FT_UInt gindex;
+    FT_ULong ucs4;
+    twin_font_t *font;
+    int nglyphs = 0, nbad = 0;
+
+    if (argc != 3)
+        return 1;
+    if (FT_Init_FreeType(&ftLibrary) ||
+        FT_New_Face(ftLibrary, argv[1], 0, &face) ||
+        FT_Select_Charmap(face, ft_encoding_unicode))
+        return 1;
+    font = twin_font_open(argv[2]);
+    if (!font)
+        return 1;
+
+    for (ucs4 = FT_Get_First_Char(face, &gindex); gindex != 0;
+         ucs4 = FT_Get_Next_Char(face, ucs4, &gindex)) {
+        if (FT_Load_Glyph(face, gindex,
+                          FT_LOAD_NO_SCALE | FT_LOAD_LINEAR_DESIGN) != 0)
+            continue;
+        nglyphs++;
+        if (!check_glyph(face, font, ucs4))
+            nbad++;
+    }
+    printf("%d of %d glyphs differ\n", nbad, nglyphs);
+    twin_font_close(font);
+    return nbad != 0;
+}
@@ -29,16 +29,47 @@ static double pos(FT_Pos x, outline_closure_t *c)
     return (double) x / (double) face->units_per_EM;
 }
 
-static void command(char cmd, outline_closure_t *c)
+static void put(int v, const char *fmt, outline_closure_t *c)
 {
-    printf("\t'%c', ", cmd);
+    if (c->binary) {
+        if (c->offset == c->size) {
+            c->size = c->size ? c->size * 2 : 4096;
+            c->data = realloc(c->data, c->size);
+            if (!c->data)
+                exit(1);
+        }
+        c->data[c->offset] = v;
+    } else
+        printf(fmt, v);
     c->offset++;
 }
 
+static void text(const char *s, outline_closure_t *c)
+{
+    if (!c->binary)
+        fputs(s, stdout);
+}
+
+/* Coordinates are signed bytes in 1/64 em, so anything past 2 em clamps */
+static int fpos(FT_Pos x, outline_closure_t *c)
+{
+    int v = (int) floor(64.0 * pos(x, c) + 0.5);
+
+    if (v < -128 || v > 127) {
+        v = v < 0 ? -128 : 127;
+        c->clamped++;
+    }
+    return v & 0xff;
+}
+
+static void command(char cmd, outline_closure_t *c)
+{
+    put(cmd, "\t'%c', ", c);
+}
+
 static void cpos(FT_Pos x, outline_closure_t *c)
 {
-    printf("0x%02x, ", ((int) (floor(64.0 * pos(x, c) + 0.5))) & 0xff);
-    c->offset++;
+    put(fpos(x, c), "0x%02x, ", c);
 }
 
 static unsigned char *ucs4_to_utf8(FT_ULong ucs4, unsigned char dest[8])
@@ -74,12 +105,23 @@ static unsigned char *ucs4_to_utf8(FT_ULong ucs4, unsigned char dest[8])
     return dest;
 }
 
-static void glyph(FT_Pos advance, FT_ULong ucs4, outline_closure_t *c)
+/*
+ * The left, right, ascent and descent bytes twin_glyph_draw() skips. The
+ * runtime takes the advance from the right edge, so that is what goes
+ * there; y grows downwards as in the stroke font.
+ */
+static void glyph(FT_GlyphSlot slot, FT_ULong ucs4, outline_closure_t *c)
 {
+    FT_Glyph_Metrics *metrics = &slot->metrics;
     unsigned char utf8[8];
-    printf("    /* 0x%lx (%s) */ ", ucs4, ucs4_to_utf8(ucs4, utf8));
-    cpos(advance, c);
-    printf("\n");
+
+    if (!c->binary)
+        printf("    /* 0x%lx (%s) */ ", ucs4, ucs4_to_utf8(ucs4, utf8));
+    cpos(metrics->horiBearingX, c);
+    cpos(slot->linearHoriAdvance, c);
+    cpos(metrics->horiBearingY, c);
+    cpos(metrics->height - metrics->horiBearingY, c);
+    text("\n", c);
 }
 
 static int outline_moveto(const FT_Vector *to, void *user)
@@ -87,8 +129,8 @@ static int outline_moveto(const FT_Vector *to, void *user)
     outline_closure_t *c = user;
     command('m', c);
     cpos(to->x, c);
-    cpos(to->y, c);
-    printf("\n");
+    cpos(-to->y, c);
+    text("\n", c);
     return 0;
 }
 
@@ -97,8 +139,8 @@ static int outline_lineto(const FT_Vector *to, void *user)
     outline_closure_t *c = user;
     command('l', c);
     cpos(to->x, c);
-    cpos(to->y, c);
-    printf("\n");
+    cpos(-to->y, c);
+    text("\n", c);
     return 0;
 }
 
@@ -109,10 +151,10 @@ static int outline_conicto(const FT_Vector *control,
     outline_closure_t *c = user;
     command('2', c);
     cpos(control->x, c);
-    cpos(control->y, c);
+    cpos(-control->y, c);
     cpos(to->x, c);
-    cpos(to->y, c);
-    printf("\n");
+    cpos(-to->y, c);
+    text("\n", c);
     return 0;
 }
 
@@ -122,14 +164,14 @@ static int outline_cubicto(const FT_Vector *control1,
                            void *user)
 {
     outline_closure_t *c = user;
-    command('2', c);
+    command('c', c);
     cpos(control1->x, c);
-    cpos(control1->y, c);
+    cpos(-control1->y, c);
     cpos(control2->x, c);
-    cpos(control2->y, c);
+    cpos(-control2->y, c);
     cpos(to->x, c);
-    cpos(to->y, c);
-    printf("\n");
+    cpos(-to->y, c);
+    text("\n", c);
     return 0;
 }
 
@@ -137,9 +179,6 @@ static const FT_Outline_Funcs outline_funcs = {
     outline_moveto, outline_lineto, outline_conicto, outline_cubicto, 0, 0,
 };
 
-#define UCS_PAGE_SHIFT 7
-#define UCS_PER_PAGE (1 << UCS_PAGE_SHIFT)
-
 static int ucs_page(FT_ULong ucs4)
 {
     return ucs4 >> UCS_PAGE_SHIFT;
@@ -181,8 +220,193 @@ static char *facename(FT_Face face)
 }
 
 #define MAX_UCS4 0x1000000
+/*
+ * Render every glyph hinted to 8-bit coverage at one pixel size, with rows
+ * padded to 4 bytes so the runtime can use the bits as a pixmap in place.
+ */
+static int render_strike(FT_Face face, int size, strike_t *strike)
+{
+    FT_GlyphSlot slot = face->glyph;
+    FT_UInt gindex;
+    FT_ULong ucs4;
+    unsigned long nalloc = 0;
+
+    if (FT_Set_Pixel_Sizes(face, 0, size))
+        return 0;
+
+    strike->size = size;
+    strike->nglyphs = 0;
+    strike->glyphs = calloc(face->num_glyphs + 1, sizeof(strike_glyph_t));
+    strike->bits = NULL;
+    strike->nbits = 0;
+    if (!strike->glyphs)
+        return 0;
+
+    for (ucs4 = FT_Get_First_Char(face, &gindex);
+         gindex != 0 && ucs4 < MAX_UCS4 && strike->nglyphs <= face->num_glyphs;
+         ucs4 = FT_Get_Next_Char(face, ucs4, &gindex)) {
+        FT_Bitmap *bitmap = &slot->bitmap;
+        strike_glyph_t *g = &strike->glyphs[strike->nglyphs];
+        unsigned long need;
+        int stride;
+
+        if (FT_Load_Glyph(face, gindex, FT_LOAD_RENDER) != 0)
+            continue;
+        if (bitmap->rows && bitmap->pixel_mode != FT_PIXEL_MODE_GRAY)
+            continue;
+
+        g->ucs4 = ucs4;
+        g->left = slot->bitmap_left;
+        g->top = slot->bitmap_top;
+        g->width = bitmap->width;
+        g->height = bitmap->rows;
+        g->advance = slot->advance.x;
+        g->offset = strike->nbits;
+        strike->nglyphs++;
+
+        stride = (g->width + 3) & ~3;
+        need = strike->nbits + (unsigned long) stride * g->height;
+        if (need > nalloc) {
+            nalloc = need * 2;
+            strike->bits = realloc(strike->bits, nalloc);
+            if (!strike->bits)
+                return 0;
+        }
+        for (int y = 0; y < g->height; y++) {
+            unsigned char *dst = strike->bits + strike->nbits + y * stride;
+
+            memset(dst, 0, stride);
+            memcpy(dst, bitmap->buffer + y * bitmap->pitch, g->width);
+        }
+        strike->nbits = need;
+    }
+    return 1;
+}
+
+static void print_strike(const strike_t *strike)
+{
+    printf("/* clang-format off */\n");
+    printf("static const uint8_t strike_%d_bits[] = {\n", strike->size);
+    for (int i = 0; i < strike->nglyphs; i++) {
+        const strike_glyph_t *g = &strike->glyphs[i];
+        int stride = (g->width + 3) & ~3;
+
+        printf("    /* 0x%lx */\n", g->ucs4);
+        for (int y = 0; y < g->height; y++) {
+            printf("   ");
+            for (int x = 0; x < stride; x++)
+                printf(" 0x%02x,", strike->bits[g->offset + y * stride + x]);
+            printf("\n");
+        }
+    }
+    printf("};\n\n");
+
+    printf("static const twin_font_bitmap_t strike_%d_bitmaps[] = {\n",
+           strike->size);
+    for (int i = 0; i < strike->nglyphs; i++) {
+        const strike_glyph_t *g = &strike->glyphs[i];
+
+        /* twin puts y downwards, and advances are 16.16 rather than 26.6 */
+        printf("    { 0x%04lx, %d, %d, %d, %d, %ld, %lu },\n", g->ucs4,
+               g->left, -g->top, g->width, g->height, (long) g->advance << 10,
+               g->offset);
+    }
+    printf("};\n");
+    printf("/* clang-format on */\n\n");
+}
+
+/* Append len bytes to the file image at a 4 byte boundary */
+static uint32_t add(unsigned char **file,
+                    uint32_t *size,
+                    const void *data,
+                    size_t len)
+{
+    uint32_t offset = (*size + 3) & ~3;
+
+    *file = realloc(*file, offset + len);
+    if (!*file)
+        exit(1);
+    memset(*file + *size, 0, offset - *size);
+    memcpy(*file + offset, data, len);
+    *size = offset + len;
+    return offset;
+}
+
+/* Write the font to stdout in the format read by twin_font_open() */
+static int write_font(FT_Face face,
+                      outline_closure_t *c,
+                      const twin_charmap_t *charmap,
+                      int ncharmap,
+                      const strike_t *strikes,
+                      int nstrikes)
+{
+    twin_font_file_header_t h = {
+        .magic = TWIN_FONT_FILE_MAGIC,
+        .version = TWIN_FONT_FILE_VERSION,
+        .type = nstrikes ? TWIN_FONT_TYPE_BITMAP : TWIN_FONT_TYPE_TTF,
+        .ascender = fpos(face->ascender, c),
+        .descender = fpos(face->descender, c),
+        .height = fpos(face->height, c),
+        .n_charmap = ncharmap,
+        .n_outlines = c->offset,
+        .n_strikes = nstrikes,
+    };
+    twin_font_file_strike_t *s = calloc(nstrikes + 1, sizeof(*s));
+    unsigned char *file = NULL;
+    uint32_t size = 0;
+
+    if (!s)
+        return 0;
 
-static int convert_font(char *in_name, int id)
+    add(&file, &size, &h, sizeof(h));
+    h.name = add(&file, &size, face->family_name,
+                 strlen(face->family_name) + 1);
+    h.style =
+        add(&file, &size, face->style_name, strlen(face->style_name) + 1);
+    h.charmap = add(&file, &size, charmap, ncharmap * sizeof(*charmap));
+    h.outlines = add(&file, &size, c->data, c->offset);
+    for (int i = 0; i < nstrikes; i++) {
+        twin_font_bitmap_t *bitmaps =
+            calloc(strikes[i].nglyphs + 1, sizeof(*bitmaps));
+
+        if (!bitmaps)
+            return 0;
+        for (int j = 0; j < strikes[i].nglyphs; j++) {
+            const strike_glyph_t *g = &strikes[i].glyphs[j];
+
+            bitmaps[j] = (twin_font_bitmap_t){
+                .ucs4 = g->ucs4,
+                .left = g->left,
+                .top = -g->top,
+                .width = g->width,
+                .height = g->height,
+                .advance = (twin_fixed_t) (g->advance << 10),
+                .offset = g->offset,
+            };
+        }
+        s[i].size = strikes[i].size;
+        s[i].n_bitmaps = strikes[i].nglyphs;
+        s[i].bitmaps = add(&file, &size, bitmaps,
+                           strikes[i].nglyphs * sizeof(*bitmaps));
+        s[i].n_bits = strikes[i].nbits;
+        s[i].bits = add(&file, &size, strikes[i].bits, strikes[i].nbits);
+        free(bitmaps);
+    }
+    h.strikes = add(&file, &size, s, nstrikes * sizeof(*s));
+    memcpy(file, &h, sizeof(h));
+
+    free(s);
+    if (fwrite(file, 1, size, stdout) != size || fflush(stdout))
+        return 0;
+    free(file);
+    return 1;
+}
+
+static int convert_font(char *in_name,
+                        int id,
+                        const int *sizes,
+                        int nsizes,
+                        int binary)
 {
     FT_Library ftLibrary;
     FT_Face face;
@@ -192,7 +416,9 @@ static int convert_font(char *in_name, int id)
     outline_closure_t closure;
     FT_ULong min_ucs4, max_ucs4;
     int *offsets;
-    int ncharmap;
+    twin_charmap_t *charmap = NULL;
+    int ncharmap, nalloc = 0;
+    strike_t *strikes;
 
     if (FT_Init_FreeType(&ftLibrary))
         return 0;
@@ -207,15 +433,21 @@ static int convert_font(char *in_name, int id)
 
     closure.face = face;
     closure.offset = 0;
+    closure.binary = binary;
+    closure.data = NULL;
+    closure.size = 0;
+    closure.clamped = 0;
 
     offsets = calloc(face->num_glyphs + 1, sizeof(int));
 
     min_ucs4 = 0xffffff;
     max_ucs4 = 0;
-    printf("/* Derived from %s */\n\n", in_name);
-    printf("#include \"twin_private.h\"\n\n");
-    printf("/* clang-format off */\n");
-    printf("static const char outlines[] = {\n");
+    if (!binary) {
+        printf("/* Derived from %s */\n\n", in_name);
+        printf("#include \"twin_private.h\"\n\n");
+        printf("/* clang-format off */\n");
+        printf("static const char outlines[] = {\n");
+    }
     for (ucs4 = FT_Get_First_Char(face, &gindex);
          gindex != 0 && ucs4 < MAX_UCS4;
          ucs4 = FT_Get_Next_Char(face, ucs4, &gindex)) {
@@ -225,15 +457,18 @@ static int convert_font(char *in_name, int id)
             min_ucs4 = ucs4;
         if (ucs4 > max_ucs4)
             max_ucs4 = ucs4;
-        offsets[gindex] = closure.offset + 1;
-        glyph(face->glyph->linearHoriAdvance, ucs4, &closure);
+        offsets[gindex] = closure.offset;
+        glyph(face->glyph, ucs4, &closure);
         FT_Outline_Decompose(&face->glyph->outline, &outline_funcs, &closure);
         command('e', &closure);
-        printf("\n");
+        text("\n", &closure);
     }
-    printf("};\n");
-    printf("/* clang-format on */\n\n");
-    printf("static const twin_charmap_t charmap[] = {\n");
+    text("};\n", &closure);
+    text("/* clang-format on */\n\n", &closure);
+    if (closure.clamped)
+        fprintf(stderr, "%s: %d coordinates clamped to 2 em\n", in_name,
+                closure.clamped);
+
     ncharmap = 0;
     for (ucs4 = FT_Get_First_Char(face, &gindex);
          gindex != 0 && ucs4 < MAX_UCS4;
@@ -241,21 +476,57 @@ static int convert_font(char *in_name, int id)
         FT_ULong page = ucs_first_in_page(ucs4);
         FT_ULong off;
 
-        printf("    { 0x%04x, {\n", ucs_page(page));
-        for (off = 0; off < UCS_PER_PAGE; off++) {
-            FT_UInt g = FT_Get_Char_Index(face, page + off);
+        if (ncharmap == nalloc) {
+            nalloc = nalloc ? nalloc * 2 : 64;
+            charmap = realloc(charmap, nalloc * sizeof(*charmap));
+            if (!charmap)
+                return 0;
+        }
+        charmap[ncharmap].page = ucs_page(page);
+        for (off = 0; off < UCS_PER_PAGE; off++)
+            charmap[ncharmap].offsets[off] =
+                offsets[FT_Get_Char_Index(face, page + off)];
+        ucs4 = page + UCS_PER_PAGE - 1;
+        ncharmap++;
+    }
+
+    strikes = calloc(nsizes + 1, sizeof(strike_t));
+    if (!strikes)
+        return 0;
+    for (int i = 0; i < nsizes; i++)
+        if (!render_strike(face, sizes[i], &strikes[i]))
+            return 0;
+
+    if (binary)
+        return write_font(face, &closure, charmap, ncharmap, strikes, nsizes);
+
+    printf("static const twin_charmap_t charmap[] = {\n");
+    for (int i = 0; i < ncharmap; i++) {
+        printf("    { 0x%04x, {\n", charmap[i].page);
+        for (int off = 0; off < UCS_PER_PAGE; off++) {
             if ((off & 7) == 0)
                 printf("\t");
-            printf("0x%04x, ", offsets[g]);
+            printf("0x%04x, ", charmap[i].offsets[off]);
             if ((off & 7) == 7)
                 printf("\n");
         }
         printf("    }},\n");
-        ucs4 = page + UCS_PER_PAGE - 1;
-        ncharmap++;
     }
     printf("};\n\n");
+
+    if (nsizes) {
+        for (int i = 0; i < nsizes; i++)
+            print_strike(&strikes[i]);
+        printf("static const twin_font_strike_t strikes[] = {\n");
+        for (int i = 0; i < nsizes; i++)
+            printf("    { %d, %d, strike_%d_bitmaps, strike_%d_bits },\n",
+                   sizes[i], strikes[i].nglyphs, sizes[i], sizes[i]);
+        printf("};\n\n");
+    }
+
     printf("twin_font_t twin_%s = {\n", facename(face));
+    printf("    .type = %s,\n",
+           nsizes ? "TWIN_FONT_TYPE_BITMAP" : "TWIN_FONT_TYPE_TTF");
     printf("    .name = \"%s\",\n", face->family_name);
     printf("    .style = \"%s\",\n", face->style_name);
     printf("    .n_charmap = %d,\n", ncharmap);
@@ -270,15 +541,45 @@ static int convert_font(char *in_name, int id)
     printf("    .height = ");
     cpos(face->height, &closure);
     printf("\n");
+    if (nsizes) {
+        printf("    .strikes = strikes,\n");
+        printf("    .n_strikes = %d,\n", nsizes);
+    }
     printf("};\n");
     return 1;
 }
 
+/*
+ * twin-ttf [-b] font.ttf [pixel-size ...]
+ *
+ * Prints the font as C source, or with -b as a binary font file for
+ * twin_font_open().
+ */
 int main(int argc, char **argv)
 {
+    int binary = 0;
+    int *sizes;
+    int nsizes;
+
+    if (argc > 1 && !strcmp(argv[1], "-b")) {
+        binary = 1;
+        argc--;
+        argv++;
+    }
     if (argc < 2)
         return 1;
 
-    convert_font(argv[1], 0);
+    nsizes = argc - 2;
+    sizes = calloc(nsizes + 1, sizeof(int));
+    if (!sizes)
+        return 1;
+    for (int i = 0; i < nsizes; i++) {
+        sizes[i] = atoi(argv[i + 2]);
+        if (sizes[i] <= 0)
+            return 1;
+    }
+
+    if (!convert_font(argv[1], 0, sizes, nsizes, binary))
+        return 1;
     return 0;
 }
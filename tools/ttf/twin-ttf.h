@@ -30,10 +30,34 @@
 #include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+
+#include "font-file.h"
+#include "twin.h"
 
 typedef struct {
     FT_Face face;
     int offset;
+    int binary;          /* collect outline bytes instead of printing */
+    unsigned char *data; /* collected outline bytes */
+    int size;
+    int clamped; /* coordinates that did not fit a signed byte */
 } outline_closure_t;
 
+typedef struct {
+    FT_ULong ucs4;
+    int left, top;
+    int width, height;
+    FT_Pos advance;
+    unsigned long offset;
+} strike_glyph_t;
+
+typedef struct {
+    int size;
+    int nglyphs;
+    strike_glyph_t *glyphs;
+    unsigned char *bits;
+    unsigned long nbits;
+} strike_t;
+
 #endif /* _TWIN_TTF_H_ */